@@ -0,0 +1,331 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "beat.h"
+#include "fft_plans.h"
+
+/* Precedes each period's samples in the ring. */
+struct beat_period {
+	jack_nframes_t frame_time;
+	jack_nframes_t nframes;
+};
+
+BeatTracker::BeatTracker() {
+	active = 0;
+	overruns = 0;
+	dropped_events = 0;
+	ring = events = NULL;
+	wake = NULL;
+	wake_arg = NULL;
+	quit = 0;
+	window = history = in = prev = flux = strength = lin = NULL;
+	out = NULL;
+	plan = NULL;
+	block = NULL;
+	grid.store(0);
+}
+
+int BeatTracker::init(jack_nframes_t sample_rate, void (*wake)(void *), void *wake_arg) {
+	const int nbins = BEAT_FFT_SIZE / 2 + 1;
+	this->sample_rate = sample_rate;
+	this->wake = wake;
+	this->wake_arg = wake_arg;
+	this->overruns = 0;
+	this->dropped_events = 0;
+	this->naverage = lround(ONSET_AVERAGE * sample_rate / BEAT_HOP);
+	if (this->naverage < 1) this->naverage = 1;
+	this->nstrength = lround(BEAT_HISTORY * sample_rate / BEAT_HOP);
+	this->tempo_every = lround(BEAT_TEMPO_INTERVAL * sample_rate / BEAT_HOP);
+	this->ring = jack_ringbuffer_create(BEAT_RING_SECONDS * sample_rate *
+										sizeof(jack_default_audio_sample_t));
+	this->events = jack_ringbuffer_create(BEAT_MAX_EVENTS * sizeof(beat_event));
+	this->window = fftw_alloc_real(BEAT_FFT_SIZE);
+	this->history = fftw_alloc_real(BEAT_FFT_SIZE);
+	this->in = fftw_alloc_real(BEAT_FFT_SIZE);
+	this->out = fftw_alloc_complex(nbins);
+	this->prev = (double *)calloc(nbins, sizeof(double));
+	this->block = (jack_default_audio_sample_t *)malloc(sizeof(jack_default_audio_sample_t) * BEAT_HOP);
+	this->flux = (double *)calloc(this->naverage, sizeof(double));
+	this->strength = (double *)calloc(this->nstrength, sizeof(double));
+	this->lin = (double *)calloc(this->nstrength, sizeof(double));
+	if (!this->ring || !this->events || !this->window || !this->history || !this->in ||
+			!this->out || !this->prev || !this->block || !this->flux ||
+			!this->strength || !this->lin) {
+		fprintf(stderr, "Could not allocate beat tracker\n");
+		exit(1);
+	}
+	jack_ringbuffer_mlock(this->ring);
+	for (int i = 0; i < BEAT_FFT_SIZE; i++) {
+		this->window[i] = 0.5 * (1 - cos(2 * M_PI * i / BEAT_FFT_SIZE));
+	}
+	memset(this->history, 0, sizeof(double) * BEAT_FFT_SIZE);
+	fft_plan_lock();
+	this->plan = fftw_plan_dft_r2c_1d(BEAT_FFT_SIZE, this->in, this->out, FFTW_MEASURE);
+	fft_plan_unlock();
+	this->fill = 0;
+	this->now = 0;
+	this->last_frame_time = 0;
+	this->flux_sum = 0;
+	this->nflux = 0;
+	this->above = 0;
+	this->strength_pos = 0;
+	this->hops = 0;
+	this->last_onset = 0;
+	this->period = 0;
+	this->next_beat = 0;
+	this->last_beat = 0;
+	this->grid.store(0);
+	this->quit = 0;
+	this->data_ready.init();
+	if (pthread_create(&this->thread_id, NULL, BeatTracker::thread, this)) {
+		fprintf(stderr, "Could not start beat thread\n");
+		exit(1);
+	}
+	pthread_setname_np(this->thread_id, "v4l2_wl_beat");
+	this->active = 1;
+	return 0;
+}
+
+void BeatTracker::free() {
+	if (!this->ring) return;
+	this->active = 0;
+	this->quit = 1;
+	this->data_ready.notify();
+	pthread_join(this->thread_id, NULL);
+	this->data_ready.free();
+	fft_plan_lock();
+	fftw_destroy_plan(this->plan);
+	fft_plan_unlock();
+	fftw_free(this->window);
+	fftw_free(this->history);
+	fftw_free(this->in);
+	fftw_free(this->out);
+	::free(this->prev);
+	::free(this->block);
+	::free(this->flux);
+	::free(this->strength);
+	::free(this->lin);
+	jack_ringbuffer_free(this->ring);
+	jack_ringbuffer_free(this->events);
+	this->ring = NULL;
+	this->events = NULL;
+}
+
+/* Called from the JACK process callback. */
+void BeatTracker::write(const jack_default_audio_sample_t *in, jack_nframes_t nframes,
+						jack_nframes_t frame_time) {
+	beat_period p;
+	size_t len = nframes * sizeof(jack_default_audio_sample_t);
+	if (!this->active) return;
+	if (jack_ringbuffer_write_space(this->ring) < sizeof(p) + len) {
+		this->overruns.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	p.frame_time = frame_time;
+	p.nframes = nframes;
+	jack_ringbuffer_write(this->ring, (const char *)&p, sizeof(p));
+	jack_ringbuffer_write(this->ring, (const char *)in, len);
+	this->data_ready.notify();
+}
+
+/* Takes the oldest onset or beat the GUI has not seen yet. */
+int BeatTracker::read_event(beat_event *ev) {
+	if (!this->events || jack_ringbuffer_read_space(this->events) < sizeof(*ev)) return 0;
+	jack_ringbuffer_read(this->events, (char *)ev, sizeof(*ev));
+	return 1;
+}
+
+/* The newest beat and the frames per beat, for a clock running in the
+ * JACK callback. Returns 0 while there is no tempo or no beat in phase. */
+int BeatTracker::clock(jack_nframes_t *beat_time, double *period) const {
+	uint64_t g = this->grid.load(std::memory_order_acquire);
+	if (!g) return 0;
+	*beat_time = g >> 32;
+	*period = (g & 0xFFFFFFFF) / 256.0;
+	return 1;
+}
+
+void BeatTracker::emit(int type, int64_t at, double strength) {
+	beat_event ev;
+	ev.time = (jack_nframes_t)at;
+	ev.type = type;
+	ev.strength = strength;
+	ev.bpm = this->period > 0 ? 60 * this->sample_rate / this->period : 0;
+	if (jack_ringbuffer_write_space(this->events) < sizeof(ev)) {
+		this->dropped_events.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	jack_ringbuffer_write(this->events, (const char *)&ev, sizeof(ev));
+	if (this->wake) this->wake(this->wake_arg);
+}
+
+/* Autocorrelation of the onset strength at lag hops, weighted toward
+ * BEAT_PRIOR_BPM so a tempo is not mistaken for its half or double. */
+double BeatTracker::tempo_score(int lag) {
+	double ac = 0;
+	double bpm = 60 * this->sample_rate / ((double)lag * BEAT_HOP);
+	double octaves = log2(bpm / BEAT_PRIOR_BPM) / BEAT_PRIOR_OCTAVES;
+	for (int i = lag; i < this->nstrength; i++) {
+		ac += this->lin[i] * this->lin[i - lag];
+	}
+	return ac / (this->nstrength - lag) * exp(-0.5 * octaves * octaves);
+}
+
+void BeatTracker::estimate_tempo() {
+	const double rate = this->sample_rate / BEAT_HOP;
+	int lo = floor(60 * rate / BEAT_MAX_BPM);
+	int hi = ceil(60 * rate / BEAT_MIN_BPM);
+	int best_lag = 0;
+	double best = 0, score, p;
+	if (lo < 2) lo = 2;
+	if (hi > this->nstrength / 2) hi = this->nstrength / 2;
+	for (int i = 0; i < this->nstrength; i++) {
+		this->lin[i] = this->strength[(this->strength_pos + i) % this->nstrength];
+	}
+	for (int lag = lo; lag <= hi; lag++) {
+		score = this->tempo_score(lag);
+		if (score > best) {
+			best = score;
+			best_lag = lag;
+		}
+	}
+	if (!best_lag) return;
+	/* Parabolic interpolation between lags, since a hop is coarse next
+	 * to the spacing of tempos around BEAT_PRIOR_BPM. */
+	double a = this->tempo_score(best_lag - 1);
+	double c = this->tempo_score(best_lag + 1);
+	double denom = a - 2 * best + c;
+	double offset = denom < 0 ? 0.5 * (a - c) / denom : 0;
+	if (offset > 0.5) offset = 0.5;
+	if (offset < -0.5) offset = -0.5;
+	p = (best_lag + offset) * BEAT_HOP;
+	if (this->period > 0 && fabs(p - this->period) < 0.1 * this->period) {
+		this->period += 0.25 * (p - this->period);
+	} else {
+		this->period = p;
+	}
+}
+
+/* Starts the beat grid at the first onset once the tempo is known,
+ * then nudges it toward every onset that lands near a beat. */
+void BeatTracker::onset(int64_t at, double strength) {
+	this->last_onset = at;
+	this->emit(BEAT_ONSET, at, strength);
+	if (this->period <= 0) return;
+	if (!this->next_beat) {
+		this->next_beat = at;
+		return;
+	}
+	double err = at - this->next_beat;
+	if (this->last_beat && fabs(at - this->last_beat) < fabs(err)) {
+		err = at - this->last_beat;
+	}
+	if (fabs(err) < BEAT_TOLERANCE * this->period) {
+		this->next_beat += BEAT_PHASE_GAIN * err;
+	}
+}
+
+/* end is the frame time just after the newest hop in block. */
+void BeatTracker::analyze(int64_t end) {
+	const int nbins = BEAT_FFT_SIZE / 2 + 1;
+	const double scale = 4.0 / BEAT_FFT_SIZE;
+	const int64_t hop_start = end - BEAT_HOP;
+	double f = 0, mean, threshold;
+	memmove(this->history, this->history + BEAT_HOP,
+			sizeof(double) * (BEAT_FFT_SIZE - BEAT_HOP));
+	for (int i = 0; i < BEAT_HOP; i++) {
+		this->history[BEAT_FFT_SIZE - BEAT_HOP + i] = this->block[i];
+	}
+	for (int i = 0; i < BEAT_FFT_SIZE; i++) {
+		this->in[i] = this->history[i] * this->window[i];
+	}
+	fftw_execute(this->plan);
+	/* Spectral flux: the summed rise of log compressed magnitudes, which
+	 * weighs a soft high hat about as much as a loud kick. */
+	for (int k = 1; k < nbins; k++) {
+		double c = log1p(ONSET_COMPRESSION * scale *
+						 sqrt(this->out[k][0] * this->out[k][0] +
+							  this->out[k][1] * this->out[k][1]));
+		if (c > this->prev[k]) f += c - this->prev[k];
+		this->prev[k] = c;
+	}
+	f /= nbins;
+	mean = this->nflux ? this->flux_sum / this->nflux : 0;
+	threshold = ONSET_DELTA + ONSET_MULTIPLIER * mean;
+	if (f > threshold) {
+		if (!this->above && (!this->last_onset ||
+				hop_start - this->last_onset >= ONSET_MIN_INTERVAL * this->sample_rate)) {
+			this->onset(hop_start, f / threshold);
+		}
+		this->above = 1;
+	} else {
+		this->above = 0;
+	}
+	int slot = this->hops % this->naverage;
+	if (this->nflux == this->naverage) {
+		this->flux_sum -= this->flux[slot];
+	} else {
+		this->nflux++;
+	}
+	this->flux[slot] = f;
+	this->flux_sum += f;
+	this->strength[this->strength_pos] = f > mean ? f - mean : 0;
+	this->strength_pos = (this->strength_pos + 1) % this->nstrength;
+	this->hops++;
+	if (this->hops >= this->nstrength / 2 && this->hops % this->tempo_every == 0) {
+		this->estimate_tempo();
+	}
+	/* With nothing heard for a while the grid is dropped, so the beats
+	 * stop with the music rather than running on. */
+	if (this->next_beat && end - this->last_onset > BEAT_HISTORY * this->sample_rate) {
+		this->next_beat = 0;
+		this->last_beat = 0;
+		this->grid.store(0, std::memory_order_release);
+	}
+	while (this->period > 0 && this->next_beat && this->next_beat <= end) {
+		this->emit(BEAT_BEAT, llround(this->next_beat), 1);
+		this->last_beat = this->next_beat;
+		this->next_beat += this->period;
+		this->grid.store(((uint64_t)(jack_nframes_t)llround(this->last_beat) << 32) |
+						 (uint32_t)llround(this->period * 256), std::memory_order_release);
+	}
+}
+
+void *BeatTracker::thread(void *arg) {
+	BeatTracker *bt = (BeatTracker *)arg;
+	beat_period p;
+	while (!bt->quit) {
+		while (jack_ringbuffer_read_space(bt->ring) >= sizeof(p)) {
+			jack_ringbuffer_peek(bt->ring, (char *)&p, sizeof(p));
+			if (jack_ringbuffer_read_space(bt->ring) <
+					sizeof(p) + p.nframes * sizeof(jack_default_audio_sample_t)) {
+				break;
+			}
+			jack_ringbuffer_read_advance(bt->ring, sizeof(p));
+			/* Frame times are unwrapped, and start well above zero so
+			 * zero can mean "none" for the beat times. */
+			if (!bt->now) {
+				bt->now = (int64_t)p.frame_time + ((int64_t)1 << 32);
+			} else {
+				bt->now += (int32_t)(p.frame_time - bt->last_frame_time);
+			}
+			bt->last_frame_time = p.frame_time;
+			for (jack_nframes_t off = 0; off < p.nframes;) {
+				jack_nframes_t take = BEAT_HOP - bt->fill;
+				if (take > p.nframes - off) take = p.nframes - off;
+				jack_ringbuffer_read(bt->ring, (char *)(bt->block + bt->fill),
+									 take * sizeof(jack_default_audio_sample_t));
+				bt->fill += take;
+				off += take;
+				if (bt->fill == BEAT_HOP) {
+					bt->analyze(bt->now + off);
+					bt->fill = 0;
+				}
+			}
+		}
+		bt->data_ready.wait();
+	}
+	return NULL;
+}
@@ -0,0 +1,111 @@
+#if !defined (_BEAT_H)
+#define _BEAT_H (1)
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <fftw3.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "notifier.h"
+
+#define BEAT_FFT_SIZE 512          // samples per onset analysis window
+#define BEAT_HOP 128               // samples between analyses, bounds the detection latency
+#define BEAT_RING_SECONDS 0.5      // input the ring holds before overrunning
+#define BEAT_MAX_EVENTS 64
+#define ONSET_COMPRESSION 100.0    // log(1 + c |X|) before differencing
+#define ONSET_AVERAGE 0.1          // seconds of flux in the adaptive threshold
+#define ONSET_MULTIPLIER 1.5       // times the recent mean flux
+#define ONSET_DELTA 0.02           // plus a floor, so silence does not trigger
+#define ONSET_MIN_INTERVAL 0.05    // seconds between onsets
+#define BEAT_HISTORY 4.0           // seconds of onset strength used for the tempo
+#define BEAT_TEMPO_INTERVAL 0.5    // seconds between tempo estimates
+#define BEAT_MIN_BPM 60.0
+#define BEAT_MAX_BPM 200.0
+#define BEAT_PRIOR_BPM 120.0       // tempo preferred between octave ambiguities
+#define BEAT_PRIOR_OCTAVES 1.0     // width of that preference
+#define BEAT_TOLERANCE 0.15        // of a period, for an onset to count as on the beat
+#define BEAT_PHASE_GAIN 0.3        // share of that error corrected per onset
+#define BEAT_PULSE_SCALE 1.3       // sound shape size at the top of a --beat-pulse
+#define BEAT_PULSE_SECS 0.15
+
+typedef enum {
+	BEAT_ONSET = 0,
+	BEAT_BEAT
+} beat_event_types;
+
+struct beat_event {
+	jack_nframes_t time;   // JACK frame time
+	int type;
+	float strength;        // onset flux over its threshold
+	float bpm;             // tempo when the event was made, 0 if unknown
+};
+
+/* Onsets and beats in one input channel. The JACK callback only copies
+ * each period, tagged with its frame time, into a lock-free ring. A non
+ * real time thread runs BEAT_HOP spaced FFTs over it and reports an
+ * onset at the first hop whose spectral flux crosses an adaptive
+ * threshold, without waiting for the peak, so an onset is known within
+ * a hop or two of the audio arriving. The tempo comes from the
+ * autocorrelation of the recent onset strength, and beats are
+ * predicted from it and pulled into phase by the onsets that land near
+ * them. Events are read on the GUI thread with read_event(); the beat
+ * grid is also published as one atomic word for clock() in the JACK
+ * callback. */
+class BeatTracker {
+public:
+	BeatTracker();
+	int init(jack_nframes_t sample_rate, void (*wake)(void *), void *wake_arg);
+	void free();
+	void write(const jack_default_audio_sample_t *in, jack_nframes_t nframes,
+			   jack_nframes_t frame_time);
+	int read_event(beat_event *ev);
+	int clock(jack_nframes_t *beat_time, double *period) const;
+	int active;
+	std::atomic<long> overruns;         // written by the JACK thread, relaxed
+	std::atomic<long> dropped_events;   // written by the beat thread, relaxed
+private:
+	static void *thread(void *arg);
+	void analyze(int64_t end);
+	void onset(int64_t at, double strength);
+	void estimate_tempo();
+	double tempo_score(int lag);
+	void emit(int type, int64_t at, double strength);
+	jack_ringbuffer_t *ring;
+	jack_ringbuffer_t *events;
+	pthread_t thread_id;
+	Notifier data_ready;
+	void (*wake)(void *);
+	void *wake_arg;
+	std::atomic<int> quit;
+	double sample_rate;
+	double *window;
+	double *history;
+	double *in;
+	fftw_complex *out;
+	fftw_plan plan;
+	double *prev;              // compressed magnitudes of the last hop
+	jack_default_audio_sample_t *block;
+	int fill;
+	int64_t now;               // frame time, unwrapped
+	jack_nframes_t last_frame_time;
+	double *flux;              // ring of the last naverage flux values
+	int naverage;
+	double flux_sum;
+	int nflux;
+	int above;                 // the last hop's flux was over its threshold
+	double *strength;          // ring of onset strength for the tempo
+	double *lin;
+	int nstrength;
+	int strength_pos;
+	int hops;
+	int tempo_every;
+	int64_t last_onset;
+	double period;             // frames per beat, 0 until known
+	double next_beat;          // unwrapped frame time, 0 until in phase
+	double last_beat;
+	std::atomic<uint64_t> grid;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "blob_tracker.h"
+#include "track_match.h"
+
+BlobTracker::BlobTracker() {
+	pyramid = NULL;
+	mask = NULL;
+	labels = NULL;
+	parent = NULL;
+	stats = NULL;
+	nblobs = 0;
+	next_id = 0;
+	threshold = 24;
+	min_area = 16;
+	max_jump = 96.0;
+}
+
+int BlobTracker::init(LumaPyramid *pyramid) {
+	luma_image *l = pyramid->level(BLOB_LEVEL);
+	/* With 8-connectivity a new label can only start on a pixel whose
+	 * left and upper neighbours are all background, which bounds the
+	 * first pass to one label per 2x2 cell. */
+	int max_labels = ((l->width + 1) / 2) * ((l->height + 1) / 2) + 1;
+	this->pyramid = pyramid;
+	this->width = l->width;
+	this->height = l->height;
+	this->stride = l->stride;
+	this->mask = (uint8_t *)aligned_alloc(32, this->stride * this->height);
+	this->labels = (int32_t *)malloc(sizeof(int32_t) * this->width * this->height);
+	this->parent = (int32_t *)malloc(sizeof(int32_t) * max_labels);
+	this->stats = (blob_stats *)malloc(sizeof(blob_stats) * max_labels);
+	if (!this->mask || !this->labels || !this->parent || !this->stats) {
+		fprintf(stderr, "Could not allocate blob tracker\n");
+		exit(1);
+	}
+	this->nblobs = 0;
+	this->next_id = 0;
+	return 0;
+}
+
+void BlobTracker::free() {
+	::free(this->mask);
+	::free(this->labels);
+	::free(this->parent);
+	::free(this->stats);
+	this->mask = NULL;
+	this->labels = NULL;
+	this->parent = NULL;
+	this->stats = NULL;
+	this->nblobs = 0;
+}
+
+void BlobTracker::reset() {
+	this->nblobs = 0;
+}
+
+static inline int32_t find_root(int32_t *parent, int32_t x) {
+	while (parent[x] != x) {
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+/* Roots are always the smallest label of their set, so every label's
+ * parent is no larger than the label itself. */
+static inline int32_t unite(int32_t *parent, int32_t a, int32_t b) {
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+	if (a < b) {
+		parent[b] = a;
+		return a;
+	}
+	parent[a] = b;
+	return b;
+}
+
+/* First pass of two-pass 8-connected labelling; returns the number of
+ * provisional labels. */
+int BlobTracker::label() {
+	int32_t n = 0;
+	for (int j = 0; j < this->height; j++) {
+		const uint8_t *m = this->mask + j * this->stride;
+		int32_t *l = this->labels + j * this->width;
+		int32_t *u = l - this->width;
+		for (int i = 0; i < this->width; i++) {
+			int32_t lab = 0;
+			if (!m[i]) {
+				l[i] = 0;
+				continue;
+			}
+			if (i > 0 && l[i - 1]) lab = l[i - 1];
+			if (j > 0) {
+				if (u[i]) lab = lab ? unite(this->parent, lab, u[i]) : u[i];
+				if (i > 0 && u[i - 1]) lab = lab ? unite(this->parent, lab, u[i - 1]) : u[i - 1];
+				if (i + 1 < this->width && u[i + 1]) {
+					lab = lab ? unite(this->parent, lab, u[i + 1]) : u[i + 1];
+				}
+			}
+			if (!lab) {
+				lab = ++n;
+				this->parent[lab] = lab;
+			}
+			l[i] = lab;
+		}
+	}
+	return n;
+}
+
+/* Second pass: resolve each provisional label to its root and gather
+ * the centroid and area of every component large enough to keep. */
+int BlobTracker::collect(int nlabels, blob *found) {
+	std::vector<blob> all;
+	double scale = this->pyramid->scale(BLOB_LEVEL);
+	for (int k = 1; k <= nlabels; k++) {
+		this->parent[k] = this->parent[this->parent[k]];
+	}
+	memset(this->stats, 0, sizeof(blob_stats) * (nlabels + 1));
+	for (int j = 0; j < this->height; j++) {
+		const int32_t *l = this->labels + j * this->width;
+		for (int i = 0; i < this->width; i++) {
+			if (!l[i]) continue;
+			blob_stats *s = &this->stats[this->parent[l[i]]];
+			s->sum_x += i;
+			s->sum_y += j;
+			s->area++;
+		}
+	}
+	for (int k = 1; k <= nlabels; k++) {
+		blob_stats *s = &this->stats[k];
+		if (this->parent[k] != k || s->area < this->min_area) continue;
+		blob b;
+		b.id = -1;
+		b.x = scale * ((double)s->sum_x / s->area + 0.5);
+		b.y = scale * ((double)s->sum_y / s->area + 0.5);
+		b.r = scale * sqrt(s->area / M_PI);
+		b.area = s->area;
+		b.age = 0;
+		all.push_back(b);
+	}
+	std::sort(all.begin(), all.end(), [](const blob &a, const blob &b) {
+		return a.area > b.area;
+	});
+	int n = std::min((int)all.size(), MAX_NUM_BLOBS);
+	std::copy(all.begin(), all.begin() + n, found);
+	return n;
+}
+
+/* Matched new blobs take the old blob's id; unmatched ones get fresh
+ * ids. */
+void BlobTracker::associate(blob *found, int nfound) {
+	match_point olds[MAX_NUM_BLOBS];
+	match_point news[MAX_NUM_BLOBS];
+	match_pair pairs[MAX_NUM_BLOBS];
+	for (int o = 0; o < this->nblobs; o++) {
+		olds[o].x = this->blobs[o].x;
+		olds[o].y = this->blobs[o].y;
+		olds[o].max_jump = this->max_jump;
+	}
+	for (int n = 0; n < nfound; n++) {
+		news[n].x = found[n].x;
+		news[n].y = found[n].y;
+		news[n].max_jump = 0;
+	}
+	int npairs = match_nearest(olds, this->nblobs, news, nfound, pairs);
+	for (int k = 0; k < npairs; k++) {
+		blob *b = &found[pairs[k].new_idx];
+		b->id = this->blobs[pairs[k].old_idx].id;
+		b->age = this->blobs[pairs[k].old_idx].age + 1;
+	}
+	for (int n = 0; n < nfound; n++) {
+		if (found[n].id < 0) found[n].id = this->next_id++;
+	}
+	memcpy(this->blobs, found, sizeof(blob) * nfound);
+	this->nblobs = nfound;
+}
+
+int BlobTracker::update() {
+	blob found[MAX_NUM_BLOBS];
+	if (!this->pyramid->have_prev) {
+		this->nblobs = 0;
+		return 0;
+	}
+	blob_threshold(this->pyramid->level(BLOB_LEVEL), this->pyramid->prev_level(BLOB_LEVEL),
+				   this->threshold, this->mask, this->stride);
+	int nlabels = this->label();
+	int nfound = this->collect(nlabels, found);
+	this->associate(found, nfound);
+	return this->nblobs;
+}
+
+/* mask = 0xff where |cur - prev| > threshold, else 0. */
+void blob_threshold(const luma_image *cur, const luma_image *prev,
+					uint8_t threshold, uint8_t *mask, int mask_stride) {
+	for (int j = 0; j < cur->height; j++) {
+		const uint8_t *c = cur->data + j * cur->stride;
+		const uint8_t *p = prev->data + j * prev->stride;
+		uint8_t *m = mask + j * mask_stride;
+		int i = 0;
+#if defined(__SSE2__)
+		if (threshold < 255) {
+			const __m128i t = _mm_set1_epi8((char)(threshold + 1));
+			for (; i + 16 <= cur->width; i += 16) {
+				__m128i a = _mm_loadu_si128((const __m128i *)(c + i));
+				__m128i b = _mm_loadu_si128((const __m128i *)(p + i));
+				__m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+				_mm_storeu_si128((__m128i *)(m + i),
+								 _mm_cmpeq_epi8(_mm_max_epu8(d, t), d));
+			}
+		}
+#endif
+		for (; i < cur->width; i++) {
+			m[i] = abs(c[i] - p[i]) > threshold ? 0xff : 0;
+		}
+	}
+}
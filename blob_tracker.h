@@ -0,0 +1,60 @@
+#if !defined (_BLOB_TRACKER_H)
+#define _BLOB_TRACKER_H (1)
+
+#include <stdint.h>
+
+#include "luma_pyramid.h"
+
+#define BLOB_LEVEL 2
+#define MAX_NUM_BLOBS 64
+#define BLOB_MIN_AGE 2
+
+typedef struct blob {
+	int id;
+	double x;     // centroid, full resolution pixels
+	double y;
+	double r;     // radius of a disc with the blob's area
+	int area;     // pixels on BLOB_LEVEL
+	int age;      // frames this id has been tracked
+} blob;
+
+typedef struct blob_stats {
+	int64_t sum_x;
+	int64_t sum_y;
+	int area;
+} blob_stats;
+
+/* Finds the connected regions of the thresholded frame difference on
+ * one pyramid level and keeps their ids stable from frame to frame by
+ * matching each new centroid to the nearest unclaimed old one. */
+class BlobTracker {
+public:
+	BlobTracker();
+	int init(LumaPyramid *pyramid);
+	void free();
+	int update();
+	void reset();
+	blob blobs[MAX_NUM_BLOBS];
+	int nblobs;
+	uint8_t threshold;
+	int min_area;
+	double max_jump;
+private:
+	int label();
+	int collect(int nlabels, blob *found);
+	void associate(blob *found, int nfound);
+	LumaPyramid *pyramid;
+	int width;
+	int height;
+	int stride;
+	uint8_t *mask;
+	int32_t *labels;
+	int32_t *parent;
+	blob_stats *stats;
+	int next_id;
+};
+
+void blob_threshold(const luma_image *cur, const luma_image *prev,
+					uint8_t threshold, uint8_t *mask, int mask_stride);
+
+#endif
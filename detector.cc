@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#include "detector.h"
+#include "track_match.h"
+
+DetectorWorker::DetectorWorker() {
+	active = 0;
+	frames = NULL;
+	scd = NULL;
+	bbf = NULL;
+	quit = 0;
+	next_id = 0;
+	memset(&tracks, 0, sizeof(tracks));
+	memset(&shared, 0, sizeof(shared));
+}
+
+/* Returns -1 and stays inactive if the cascade can not be read. */
+int DetectorWorker::init(TldFrames *frames, const char *cascade_path) {
+	struct stat st;
+	this->frames = frames;
+	this->active = 0;
+	if (!cascade_path || stat(cascade_path, &st)) {
+		if (cascade_path) fprintf(stderr, "Could not find detector cascade %s\n", cascade_path);
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		this->bbf = ccv_bbf_read_classifier_cascade(cascade_path);
+	} else {
+		this->scd = ccv_scd_classifier_cascade_read(cascade_path);
+	}
+	if (!this->bbf && !this->scd) {
+		fprintf(stderr, "Could not read detector cascade %s\n", cascade_path);
+		return -1;
+	}
+	this->last_seq = 0;
+	this->quit = 0;
+	this->next_id = 0;
+	if (pthread_create(&this->thread_id, NULL, DetectorWorker::thread, this)) {
+		fprintf(stderr, "Could not start detector thread\n");
+		exit(1);
+	}
+	pthread_setname_np(this->thread_id, "v4l2_wl_detect");
+	this->active = 1;
+	return 0;
+}
+
+void DetectorWorker::free() {
+	if (!this->active) return;
+	pthread_mutex_lock(&this->frames->lock);
+	this->quit = 1;
+	pthread_cond_broadcast(&this->frames->data_ready);
+	pthread_mutex_unlock(&this->frames->lock);
+	pthread_join(this->thread_id, NULL);
+	if (this->scd) ccv_scd_classifier_cascade_free(this->scd);
+	if (this->bbf) ccv_bbf_classifier_cascade_free(this->bbf);
+	this->scd = NULL;
+	this->bbf = NULL;
+	this->active = 0;
+}
+
+void DetectorWorker::read(detection_set *out) const {
+	this->lock.load(out, &this->shared);
+}
+
+static match_point rect_centroid(const ccv_rect_t *r) {
+	match_point p;
+	p.x = r->x + 0.5 * r->width;
+	p.y = r->y + 0.5 * r->height;
+	p.max_jump = std::max(r->width, r->height);
+	return p;
+}
+
+void DetectorWorker::associate(ccv_comp_t *found, int nfound) {
+	match_point olds[MAX_NUM_DETECTIONS];
+	match_point news[MAX_NUM_DETECTIONS];
+	match_pair pairs[MAX_NUM_DETECTIONS];
+	detection next[MAX_NUM_DETECTIONS];
+	int new_id[MAX_NUM_DETECTIONS];
+	uint8_t old_taken[MAX_NUM_DETECTIONS] = { 0 };
+	int n = 0;
+	nfound = std::min(nfound, MAX_NUM_DETECTIONS);
+	for (int o = 0; o < this->tracks.n; o++) {
+		olds[o] = rect_centroid(&this->tracks.d[o].rect);
+	}
+	for (int f = 0; f < nfound; f++) {
+		news[f] = rect_centroid(&found[f].rect);
+		new_id[f] = -1;
+	}
+	int npairs = match_nearest(olds, this->tracks.n, news, nfound, pairs);
+	for (int k = 0; k < npairs; k++) {
+		old_taken[pairs[k].old_idx] = 1;
+		new_id[pairs[k].new_idx] = pairs[k].old_idx;
+	}
+	for (int f = 0; f < nfound; f++) {
+		detection *d = &next[n++];
+		d->rect = found[f].rect;
+		d->confidence = found[f].classification.confidence;
+		d->misses = 0;
+		if (new_id[f] >= 0) {
+			d->id = this->tracks.d[new_id[f]].id;
+			d->age = this->tracks.d[new_id[f]].age + 1;
+		} else {
+			d->id = this->next_id++;
+			d->age = 1;
+		}
+	}
+	/* Unmatched detections keep their last box for a few runs so a
+	 * single missed run does not tear down the shape attached to it. */
+	for (int o = 0; o < this->tracks.n && n < MAX_NUM_DETECTIONS; o++) {
+		if (old_taken[o]) continue;
+		if (this->tracks.d[o].misses + 1 > DETECT_MAX_MISSES) continue;
+		next[n] = this->tracks.d[o];
+		next[n++].misses++;
+	}
+	memcpy(this->tracks.d, next, sizeof(detection) * n);
+	this->tracks.n = n;
+}
+
+void DetectorWorker::detect(tld_frame *f) {
+	ccv_array_t *seq;
+	if (this->scd) {
+		seq = ccv_scd_detect_objects(&f->mat, &this->scd, 1, ccv_scd_default_params);
+	} else {
+		seq = ccv_bbf_detect_objects(&f->mat, &this->bbf, 1, ccv_bbf_default_params);
+	}
+	std::vector<ccv_comp_t> found;
+	if (seq) {
+		for (int i = 0; i < seq->rnum; i++) {
+			found.push_back(*(ccv_comp_t *)ccv_array_get(seq, i));
+		}
+		ccv_array_free(seq);
+	}
+	std::sort(found.begin(), found.end(), [](const ccv_comp_t &a, const ccv_comp_t &b) {
+		return a.classification.confidence > b.classification.confidence;
+	});
+	this->associate(found.data(), found.size());
+	this->tracks.run++;
+	this->tracks.ts = f->ts;
+	this->lock.store(&this->shared, &this->tracks);
+}
+
+void *DetectorWorker::thread(void *arg) {
+	DetectorWorker *w = (DetectorWorker *)arg;
+	TldFrames *frames = w->frames;
+	pthread_mutex_lock(&frames->lock);
+	while (!w->quit) {
+		if (frames->latest_seq <= w->last_seq) {
+			pthread_cond_wait(&frames->data_ready, &frames->lock);
+			continue;
+		}
+		tld_frame *f = frames->acquire_latest();
+		w->last_seq = f->seq;
+		pthread_mutex_unlock(&frames->lock);
+		w->detect(f);
+		pthread_mutex_lock(&frames->lock);
+		frames->release(f);
+	}
+	pthread_mutex_unlock(&frames->lock);
+	return NULL;
+}
@@ -0,0 +1,67 @@
+#if !defined (_DETECTOR_H)
+#define _DETECTOR_H (1)
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <ccv/ccv.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "seqlock.h"
+#include "tld_worker.h"
+
+#define DETECT_INTERVAL 0.2    // seconds between detector runs
+#define DETECT_WIDTH 640       // width of the pyramid level searched
+#define MAX_NUM_DETECTIONS 16
+#define DETECT_MIN_AGE 2       // runs before a detection spawns a shape
+#define DETECT_MAX_MISSES 5    // runs a detection survives unmatched
+#define DETECT_FOLLOW 0.25     // fraction of the way a shape moves per frame
+
+typedef struct detection {
+	int id;
+	ccv_rect_t rect;       // detector level pixels
+	float confidence;
+	int age;               // runs this id has been matched
+	int misses;            // consecutive runs without a match
+} detection;
+
+typedef struct detection_set {
+	detection d[MAX_NUM_DETECTIONS];
+	int n;
+	uint64_t run;          // incremented after every detector run
+	struct timespec ts;    // time of the frame searched
+} detection_set;
+
+/* Runs a ccv SCD (cascade file) or BBF (cascade directory) detector on
+ * its own thread over frames published at a low rate, and keeps
+ * detection ids stable across runs by matching each new box to the
+ * nearest unclaimed old one. read() never blocks. */
+class DetectorWorker {
+public:
+	DetectorWorker();
+	int init(TldFrames *frames, const char *cascade_path);
+	void free();
+	void read(detection_set *out) const;
+	int active;
+private:
+	static void *thread(void *arg);
+	void detect(tld_frame *f);
+	void associate(ccv_comp_t *found, int nfound);
+	TldFrames *frames;
+	pthread_t thread_id;
+	uint64_t last_seq;
+	int quit;
+	ccv_scd_classifier_cascade_t *scd;
+	ccv_bbf_classifier_cascade_t *bbf;
+	detection_set tracks;  // worker side
+	int next_id;
+	SeqLock lock;
+	detection_set shared;
+};
+
+#endif
@@ -4,12 +4,12 @@
 #include "v4l2_wayland.h"
 #include "v4l2.h"
 #include "midi.h"
+#include "muxing.h"
 
 
 DingleDots::DingleDots() { }
 int DingleDots::init(int width, int height,
 					 int video_bitrate) {
-	int ret;
 	this->s_pressed = 0;
 	this->smdown = 0;
 	this->drawing_rect.width = width;
@@ -17,47 +17,80 @@ int DingleDots::init(int width, int height,
 	this->recording_started = 0;
 	this->recording_stopped = 0;
 	this->animating = 0;
-	this->nports = 2;
+	this->ninputs = 2;
+	this->noutputs = 2;
+	this->set_routes(NULL, 0);
+	this->file_gain = 1.0f;
 	this->make_new_tld = 0;
 	this->video_bitrate = video_bitrate;
-	this->analysis_rect.width = 260;
-	this->analysis_rect.height = 148;
+	encoder_settings_default(&this->encoder);
+	this->pyramid.init(this->drawing_rect.width, this->drawing_rect.height);
+	this->tld_level = this->pyramid.level_for_width(260);
+	this->tracker_type = TRACKER_TLD;
+	this->fft_size = SPECTRUM_DEFAULT_SIZE;
+	this->midi_latency = MIDI_DEFAULT_LATENCY;
+	this->synth_enabled = 0;
+	this->measure_latency = 0;
+	this->midi_in_port = NULL;
+	this->beat_pulse = 0;
+	this->beat_snapshot = 0;
+	this->midi_clock = 0;
+	this->midi_clock_started = 0;
+	this->beat_redraw_pending = 0;
+	this->midi_clock_last = 0;
+	this->drawing_area = NULL;
+	this->midi_cc_dropped = 0;
+	this->midi_seq = 0;
+	this->motion_cc = -1;
+	this->motion_bend = 0;
+	this->motion_pressure = 0;
+	this->midi_event_ts.tv_sec = 0;
+	this->midi_event_ts.tv_nsec = 0;
+	this->midi_last_time = 0;
+	this->analysis_rect.width = this->pyramid.level(this->tld_level)->width;
+	this->analysis_rect.height = this->pyramid.level(this->tld_level)->height;
 	this->ascale_factor_x = this->drawing_rect.width / (double)this->analysis_rect.width;
 	this->ascale_factor_y = ((double)this->drawing_rect.height) / this->analysis_rect.height;
-	this->analysis_frame = av_frame_alloc();
-	this->analysis_frame->format = AV_PIX_FMT_ARGB;
-	this->analysis_frame->width = this->analysis_rect.width;
-	this->analysis_frame->height = this->analysis_rect.height;
-	ret = av_image_alloc(this->analysis_frame->data, this->analysis_frame->linesize,
-						 this->analysis_frame->width, this->analysis_frame->height, (AVPixelFormat)this->analysis_frame->format, 1);
-	if (ret < 0) {
-		fprintf(stderr, "Could not allocate raw picture buffer\n");
-		exit(1);
+	this->tld_frames.init(this->analysis_rect.width, this->analysis_rect.height,
+						  this->pyramid.level(this->tld_level)->stride,
+						  2 * MAX_NUM_TLD_TRACKERS + 2);
+	for (int i = 0; i < MAX_NUM_TLD_TRACKERS; i++) {
+		this->tld_trackers[i].worker.init(&this->tld_frames);
 	}
-	this->analysis_resize = sws_getContext(this->drawing_rect.width, this->drawing_rect.height, AV_PIX_FMT_ARGB, this->analysis_rect.width,
-										   this->analysis_rect.height, AV_PIX_FMT_ARGB, SWS_BICUBIC, NULL, NULL, NULL);
+	this->next_tld_tracker = 0;
+	this->detect_level = this->pyramid.level_for_width(DETECT_WIDTH);
+	this->detect_frames.init(this->pyramid.level(this->detect_level)->width,
+							 this->pyramid.level(this->detect_level)->height,
+							 this->pyramid.level(this->detect_level)->stride, 3);
+	this->doing_detect = 0;
+	this->detect_run = 0;
+	this->next_detect_ts = 0;
 	this->doing_tld = 0;
 	this->doing_motion = 0;
+	this->doing_flow = 0;
+	this->doing_blobs = 0;
+	this->blob_tracker.init(&this->pyramid);
+	this->flow.init(&this->pyramid);
+	this->flow_full_scale_speed = 24.0;
+	this->flow_speed_cc = -1;
+	this->flow_direction_cc = -1;
 	this->show_shapshot_shape = 0;
 	this->mdown = 0;
 	this->dragging = 0;
 	this->selection_in_progress = 0;
 	this->motion_threshold = 0.001;
+	this->motion_engine.init(MAX_NUM_SOUND_SHAPES);
+	this->motion_engine.set_thresholds(this->motion_threshold,
+									   MOTION_OFF_RATIO * this->motion_threshold);
 	for (int i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
 		this->sound_shapes[i].clear_state();
 	}
 	snapshot_shape.init("SNAPSHOT", this->drawing_rect.width / 2., this->drawing_rect.width / 16.,
 						this->drawing_rect.width / 32., random_color(), this);
-	pthread_mutex_init(&this->video_thread_info.lock, NULL);
-	pthread_mutex_init(&this->audio_thread_info.lock, NULL);
-	pthread_mutex_init(&this->snapshot_thread_info.lock, NULL);
-	pthread_cond_init(&this->video_thread_info.data_ready, NULL);
-	pthread_cond_init(&this->audio_thread_info.data_ready, NULL);
-	pthread_cond_init(&this->snapshot_thread_info.data_ready, NULL);
-	uint32_t rb_size = 200 * 4 * 640 * 360;
-	this->snapshot_thread_info.ring_buf = jack_ringbuffer_create(rb_size);
-	memset(this->snapshot_thread_info.ring_buf->buf, 0,
-		   this->snapshot_thread_info.ring_buf->size);
+	this->video_thread_info.data_ready.init();
+	this->audio_thread_info.data_ready.init();
+	this->snapshot_thread_info.data_ready.init();
+	this->snapshot_thread_info.ring_buf = frame_queue_create();
 	pthread_create(&this->snapshot_thread_info.thread_id, NULL, snapshot_disk_thread,
 				   this);
 	return 0;
@@ -72,19 +105,44 @@ int DingleDots::deactivate_sound_shapes() {
 	return 0;
 }
 
-
-int DingleDots::free() {
-	if (this->analysis_resize) {
-		sws_freeContext(this->analysis_resize);
+/* Takes 1-based port numbers from the command line. With no routes
+ * each input feeds the output of the same number at unity gain. */
+void DingleDots::set_routes(const mixer_route *routes, int nroutes) {
+	this->nroutes = 0;
+	if (!nroutes) {
+		for (int i = 0; i < this->ninputs && i < this->noutputs; i++) {
+			this->routes[this->nroutes].in = i;
+			this->routes[this->nroutes].out = i;
+			this->routes[this->nroutes].gain = 1.0f;
+			this->nroutes++;
+		}
+		return;
 	}
-	if (this->analysis_frame) {
-		av_freep(&this->analysis_frame->data[0]);
-		av_frame_free(&this->analysis_frame);
+	for (int r = 0; r < nroutes; r++) {
+		this->routes[this->nroutes].in = routes[r].in - 1;
+		this->routes[this->nroutes].out = routes[r].out - 1;
+		this->routes[this->nroutes].gain = routes[r].gain;
+		this->nroutes++;
 	}
+}
+
+
+int DingleDots::free() {
 	if (this->screen_frame) {
 		av_freep(&this->screen_frame->data[0]);
 		av_frame_free(&this->screen_frame);
 	}
+	for (int i = 0; i < MAX_NUM_TLD_TRACKERS; i++) {
+		this->tld_trackers[i].worker.free();
+	}
+	this->tld_frames.free();
+	this->detector.free();
+	this->detect_frames.free();
+	this->blob_tracker.free();
+	this->motion_engine.free();
+	this->pyramid.free();
+	this->thread_pool.free();
+	this->frame_pool.free();
 	return 0;
 }
 
@@ -185,7 +243,7 @@ int DingleDots::add_note(char *scale_name,
 			   x, y, r, c, this);
 		s->activate();
 
-		return 0;
+		return i;
 	}
 	return -1;
 }
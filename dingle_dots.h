@@ -13,8 +13,9 @@ extern "C" {
 }
 #endif
 #include <gtk/gtk.h>
+#include <atomic>
 #include "v4l2_wayland.h"
-typedef struct midi_key_t midi_key_t;
+#include "midi_types.h"
 #include "sound_shape.h"
 #include "snapshot_shape.h"
 #include "kmeter.h"
@@ -23,12 +24,34 @@ typedef struct midi_key_t midi_key_t;
 #include "v4l2.h"
 #include "sprite.h"
 #include "easable.h"
+#include "luma_pyramid.h"
+#include "blob_tracker.h"
+#include "motion_engine.h"
+#include "tld_worker.h"
+#include "detector.h"
+#include "spectrum.h"
+#include "synth.h"
+#include "latency_probe.h"
+#include "beat.h"
+#include "muxer.h"
+#include "mixer.h"
+#include "optical_flow.h"
+#include "thread_pool.h"
+#include "frame_pool.h"
 
 #define STR_LEN 80
 #define MAX_NUM_V4L2 4
 #define MAX_NUM_VIDEO_FILES 8
 #define MAX_NUM_SPRITES 32
 #define MAX_NUM_SOUND_SHAPES 128
+#define MAX_NUM_TLD_TRACKERS 4
+#define MAX_NUM_PORTS 16
+
+typedef struct tld_tracker {
+	TldWorker worker;
+	color box_color;
+	uint8_t targets[MAX_NUM_SOUND_SHAPES];
+} tld_tracker;
 
 class DingleDots : public Easable {
 public:
@@ -36,6 +59,7 @@ public:
 	int init(int width, int height, int video_bitrate);
 	int free();
 	int deactivate_sound_shapes();
+	void set_routes(const mixer_route *routes, int nroutes);
 	int add_note(char *scale_name,
 				 int scale_num, int midi_note, int midi_channel,
 				 double x, double y, double r, color *c);
@@ -50,7 +74,6 @@ public:
 	int can_capture;
 	int audio_done;
 	int video_done;
-	int trailer_written;
 	int make_new_tld;
 	int use_rand_color_for_scale;
 	int shift_pressed;
@@ -58,30 +81,53 @@ public:
 	double selection_box_alpha;
 	uint8_t animating;
 	uint32_t video_bitrate;
+	encoder_settings encoder;
 	AVFormatContext *video_output_context;
 	struct timespec out_frame_ts;
 	disk_thread_info_t audio_thread_info;
 	disk_thread_info_t video_thread_info;
 	disk_thread_info_t snapshot_thread_info;
+	Muxer muxer;
 	AVFrame *sources_frame;
 	AVFrame *drawing_frame;
-	AVFrame *analysis_frame;
-	struct SwsContext *analysis_resize;
+	FramePool frame_pool;
+	LumaPyramid pyramid;
+	int tld_level;
+	int tracker_type;
 	AVFrame *screen_frame;
 	struct SwsContext *screen_resize;
 	AVFrame *video_frame;
 	double scale;
 	VideoFile vf[MAX_NUM_VIDEO_FILES];
+	float file_gain;             // applied to video file audio in the mix
 	int current_video_file_source_index;
 	int current_sprite_index;
 	V4l2 v4l2[MAX_NUM_V4L2];
 	Sprite sprites[MAX_NUM_SPRITES];
 	SnapshotShape snapshot_shape;
 	SoundShape sound_shapes[MAX_NUM_SOUND_SHAPES];
-	kmeter meters[2];
+	kmeter meters[MAX_NUM_PORTS];
 	GdkRectangle drawing_rect;
 	int doing_motion;
+	MotionEngine motion_engine;
 	int doing_tld;
+	TldFrames tld_frames;
+	tld_tracker tld_trackers[MAX_NUM_TLD_TRACKERS];
+	int next_tld_tracker;
+	int doing_detect;
+	int detect_level;
+	TldFrames detect_frames;
+	DetectorWorker detector;
+	uint64_t detect_run;
+	double next_detect_ts;
+	int doing_flow;
+	int doing_blobs;
+	BlobTracker blob_tracker;
+	OpticalFlow flow;
+	ThreadPool thread_pool;
+	double flow_full_scale_speed;
+	int flow_speed_cc;
+	int flow_direction_cc;
 	uint8_t show_shapshot_shape;
 	uint8_t do_snapshot;
 	GdkRectangle user_tld_rect;
@@ -108,8 +154,11 @@ public:
 	GtkWidget *record_button;
 	GtkWidget *delete_button;
 	GtkWidget *channel_combo;
-	long jack_overruns;
-	int nports;
+	std::atomic<long> jack_overruns;   // recording periods dropped
+	int ninputs;
+	int noutputs;
+	mixer_route routes[MAX_NUM_PORTS * MAX_NUM_PORTS];
+	int nroutes;
 	jack_default_audio_sample_t **in;
 	jack_default_audio_sample_t **out;
 	jack_port_t **in_ports;
@@ -117,6 +166,32 @@ public:
 	jack_client_t *client;
 	jack_port_t *midi_port;
 	jack_ringbuffer_t *midi_ring_buf;
+	jack_ringbuffer_t *midi_off_ring_buf;
+	jack_ringbuffer_t *midi_cc_ring_buf;
+	std::vector<struct midi_message> midi_off_backlog;
+	struct midi_cc_table midi_ccs;
+	long midi_cc_dropped;
+	uint32_t midi_seq;
+	int motion_cc;
+	int motion_bend;
+	int motion_pressure;
+	double midi_latency;
+	struct timespec midi_event_ts;
+	jack_nframes_t midi_last_time;
+	int fft_size;
+	SpectrumAnalyzer spectrum;
+	int synth_enabled;
+	Synth synth;
+	int measure_latency;
+	LatencyProbe latency_probe;
+	jack_port_t *midi_in_port;
+	BeatTracker beats;
+	int beat_pulse;
+	int beat_snapshot;
+	int midi_clock;
+	int midi_clock_started;
+	std::atomic<int> beat_redraw_pending;   // an idle redraw is queued
+	jack_nframes_t midi_clock_last;
 	color random_color();
 	uint8_t get_animating() const;
 	void set_animating(const uint8_t &value);
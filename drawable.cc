@@ -92,6 +92,22 @@ int Drawable::deactivate() {
 }
 
 
+/* A quick swell and back, as on a beat. Skipped while another
+ * animation is running, so the two do not fight over the scale. */
+int Drawable::pulse(double amount, double duration) {
+	if (!this->active || this->easing()) return 0;
+	double base = this->scale;
+	this->pulse_up.initialize(this, EASER_QUAD_EASE_OUT, boost::bind(&Drawable::set_scale, this, _1),
+							  base, amount * base, 0.3 * duration);
+	this->pulse_down.initialize(this, EASER_QUAD_EASE_IN, boost::bind(&Drawable::set_scale, this, _1),
+								amount * base, base, 0.7 * duration);
+	if (this->pulse_up.finsh_easers.empty()) {
+		this->pulse_up.add_finish_easer(&this->pulse_down);
+	}
+	this->pulse_up.start();
+	return 0;
+}
+
 DingleDots *Drawable::get_dingle_dots() const
 {
 	return dingle_dots;
@@ -63,8 +63,11 @@ public:
 
 	int activate_spin_and_scale_to_fit();
 	int scale_to_fit(double duration);
+	int pulse(double amount, double duration);
 protected:
 	virtual void deactivate_action();
+	Easer pulse_up;
+	Easer pulse_down;
 };
 
 #endif
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "easable.h"
 #include "easer.h"
 
@@ -21,7 +23,18 @@ void Easable::update_easers() {
 		Easer *e = to_finalize.back();
 		e->finalize();
 		to_finalize.pop_back();
+		/* Done with; start() adds it back if it is reused, as the beat
+		 * pulses are, so the list does not grow with every one. */
+		this->easers.erase(std::remove(this->easers.begin(), this->easers.end(), e),
+						   this->easers.end());
+	}
+}
+
+bool Easable::easing() {
+	for (std::vector<Easer *>::iterator it = this->easers.begin(); it != this->easers.end(); ++it) {
+		if ((*it)->active) return true;
 	}
+	return false;
 }
 
 void Easable::add_easer(Easer *value)
@@ -8,6 +8,7 @@ public:
 	Easable();
 	void update_easers();
 	void add_easer(Easer *value);
+	bool easing();
 protected:
 	std::vector<Easer *> easers;
 };
@@ -0,0 +1,58 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <fftw3.h>
+
+#include "fft_plans.h"
+
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void fft_plan_lock() {
+	pthread_mutex_lock(&plan_lock);
+}
+
+void fft_plan_unlock() {
+	pthread_mutex_unlock(&plan_lock);
+}
+
+static int wisdom_path(char *path, size_t size, int create_dir) {
+	const char *home = getenv("HOME");
+	if (!home) return -1;
+	if (create_dir) {
+		snprintf(path, size, "%s/.cache", home);
+		if (mkdir(path, 0755) && errno != EEXIST) return -1;
+		snprintf(path, size, "%s/.cache/v4l2_wayland", home);
+		if (mkdir(path, 0755) && errno != EEXIST) return -1;
+	}
+	snprintf(path, size, "%s/.cache/v4l2_wayland/fftw_wisdom", home);
+	return 0;
+}
+
+int fft_wisdom_load() {
+	char path[4096];
+	int ret;
+	if (wisdom_path(path, sizeof(path), 0)) return -1;
+	fft_plan_lock();
+	ret = fftw_import_wisdom_from_filename(path);
+	fft_plan_unlock();
+	return ret ? 0 : -1;
+}
+
+int fft_wisdom_save() {
+	char path[4096];
+	int ret;
+	if (wisdom_path(path, sizeof(path), 1)) {
+		fprintf(stderr, "Could not create fftw wisdom directory\n");
+		return -1;
+	}
+	fft_plan_lock();
+	ret = fftw_export_wisdom_to_filename(path);
+	fft_plan_unlock();
+	if (!ret) {
+		fprintf(stderr, "Could not write fftw wisdom to %s\n", path);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#if !defined (_FFT_PLANS_H)
+#define _FFT_PLANS_H (1)
+
+/* FFTW planning is not thread safe, so every fftw_plan_* and
+ * fftw_destroy_plan call goes through this lock. fftw_execute on an
+ * existing plan needs no lock. Wisdom is kept under
+ * ~/.cache/v4l2_wayland so FFTW_MEASURE plans are cheap after the first
+ * run. */
+void fft_plan_lock();
+void fft_plan_unlock();
+int fft_wisdom_load();
+int fft_wisdom_save();
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cairo.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/pixfmt.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "frame_pool.h"
+
+FramePool::FramePool() {
+	width = 0;
+	height = 0;
+	stride = 0;
+	pool = NULL;
+}
+
+void FramePool::init(int width, int height) {
+	this->width = width;
+	this->height = height;
+	this->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+	this->pool = av_buffer_pool_init(this->stride * height, NULL);
+	if (!this->pool) {
+		fprintf(stderr, "Could not allocate frame pool\n");
+		exit(1);
+	}
+}
+
+void FramePool::free() {
+	av_buffer_pool_uninit(&this->pool);
+}
+
+/* A frame holding the only reference to a pool buffer, with whatever
+ * was last drawn in it, or NULL if memory ran out. */
+AVFrame *FramePool::get() {
+	AVFrame *frame = av_frame_alloc();
+	if (!frame) return NULL;
+	frame->buf[0] = av_buffer_pool_get(this->pool);
+	if (!frame->buf[0]) {
+		av_frame_free(&frame);
+		return NULL;
+	}
+	frame->data[0] = frame->buf[0]->data;
+	frame->linesize[0] = this->stride;
+	frame->width = this->width;
+	frame->height = this->height;
+	frame->format = AV_PIX_FMT_BGRA;
+	return frame;
+}
+
+jack_ringbuffer_t *frame_queue_create() {
+	jack_ringbuffer_t *rb = jack_ringbuffer_create(FRAME_QUEUE_LENGTH * sizeof(recorded_frame));
+	if (!rb) {
+		fprintf(stderr, "Could not allocate frame queue\n");
+		exit(1);
+	}
+	return rb;
+}
+
+/* Queues a new reference to frame. Returns 0, leaving frame alone, if
+ * the queue is full. */
+int frame_queue_push(jack_ringbuffer_t *rb, const AVFrame *frame,
+					 const struct timespec *ts) {
+	recorded_frame rf;
+	if (jack_ringbuffer_write_space(rb) < sizeof(rf)) return 0;
+	rf.frame = av_frame_clone(frame);
+	if (!rf.frame) return 0;
+	rf.ts = *ts;
+	jack_ringbuffer_write(rb, (const char *)&rf, sizeof(rf));
+	return 1;
+}
+
+/* The caller owns rf->frame and frees it once done with the picture. */
+int frame_queue_pop(jack_ringbuffer_t *rb, recorded_frame *rf) {
+	if (jack_ringbuffer_read_space(rb) < sizeof(*rf)) return 0;
+	jack_ringbuffer_read(rb, (char *)rf, sizeof(*rf));
+	return 1;
+}
@@ -0,0 +1,49 @@
+#if !defined (_FRAME_POOL_H)
+#define _FRAME_POOL_H (1)
+
+#include <time.h>
+#include <jack/ringbuffer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#ifdef __cplusplus
+}
+#endif
+
+#define FRAME_QUEUE_LENGTH 20      // frames a disk thread may fall behind by
+
+typedef struct recorded_frame {
+	AVFrame *frame;            // one reference to a pool buffer
+	struct timespec ts;
+} recorded_frame;
+
+/* Full size BGRA frames for the recording layer, backed by an
+ * AVBufferPool. The compositor draws straight into a frame from get()
+ * and hands each disk thread its own reference through a frame queue;
+ * the buffer goes back to the pool when the last reference is freed,
+ * so only the frames actually waiting on a disk thread take memory.
+ * free() may be called while references are still out: the pool goes
+ * away when the last of them comes back. */
+class FramePool {
+public:
+	FramePool();
+	void init(int width, int height);
+	void free();
+	AVFrame *get();
+	int width;
+	int height;
+	int stride;                // what cairo wants for ARGB32 at width
+private:
+	AVBufferPool *pool;
+};
+
+/* A jack ringbuffer of recorded_frame, one producer and one consumer. */
+jack_ringbuffer_t *frame_queue_create();
+int frame_queue_push(jack_ringbuffer_t *rb, const AVFrame *frame,
+					 const struct timespec *ts);
+int frame_queue_pop(jack_ringbuffer_t *rb, recorded_frame *rf);
+
+#endif
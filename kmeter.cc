@@ -20,16 +20,46 @@
 
 #include <math.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "kmeter.h"
 #define GREY  0.197 / 0.255 * 1.0, 0.203 / 0.255 * 1.0, 0.203 / 0.255   * 1.0
 
-void kmeter_process(kmeter *km, float *p, int n) {
-	float  s, t, z1, z2;
+static void kmeter_reset_rms(kmeter *km) {
 	if (km->flag == 1) {// Display thread has read the rms value.
 		km->rms  = 0;
 		km->flag = 0;
 	}
+}
+
+// t is the largest squared sample of the period.
+static void kmeter_update(kmeter *km, float t, float z1, float z2) {
+	float s;
+	t = sqrtf (t);
+	// Save filter state. The added constants avoid denormals.
+	km->z1 = z1 + 1e-20f;
+	km->z2 = z2 + 1e-20f;
+	// Adjust RMS value and update maximum since last read().
+	s = sqrtf (2 * z2);
+	if (s > km->rms) km->rms = s;
+	// Digital peak hold and fallback.
+	if (t > km->dpk) {
+		// If higher than current value, update and set hold counter.
+		km->dpk = t;
+		km->cnt = km->hold;
+	} else if (km->cnt) {
+		km->cnt--; // else decrement counter if not zero,
+	} else {
+		km->dpk *= km->fall;     // else let the peak value fall back,
+		km->dpk += 1e-10f;    // and avoid denormals.
+	}
+}
+
+void kmeter_process(kmeter *km, float *p, int n) {
+	float  s, t, z1, z2;
+	kmeter_reset_rms(km);
 	z1 = km->z1;
 	z2 = km->z2;
 	t = 0;
@@ -53,23 +83,53 @@ void kmeter_process(kmeter *km, float *p, int n) {
 		z1 += km->omega * (s - z1);      // Update first filter.
 		z2 += 4 * km->omega * (z1 - z2); // Update second filter.
 	}
-	t = sqrtf (t);
-	// Save filter state. The added constants avoid denormals.
-	km->z1 = z1 + 1e-20f;
-	km->z2 = z2 + 1e-20f;
-	// Adjust RMS value and update maximum since last read().
-	s = sqrtf (2 * z2);
-	if (s > km->rms) km->rms = s;
-	// Digital peak hold and fallback.
-	if (t > km->dpk) {
-		// If higher than current value, update and set hold counter.
-		km->dpk = t;
-		km->cnt = km->hold;
-	} else if (km->cnt) {
-		km->cnt--; // else decrement counter if not zero,
-	} else {
-		km->dpk *= km->fall;     // else let the peak value fall back,
-		km->dpk += 1e-10f;    // and avoid denormals.
+	kmeter_update(km, t, z1, z2);
+}
+
+// Same ballistics as kmeter_process() on each of nchan channels, four
+// channels at a time, one per SSE lane. The filters are recursive in
+// time, so lanes are the only parallelism there is. Each step loads
+// four samples of each channel and transposes them into four time
+// steps; a group of fewer than four channels runs with zero lanes.
+void kmeter_process_multi(kmeter *km, float **p, int nchan, int n) {
+	int c = 0;
+#if defined(__SSE2__)
+	for (; c < nchan; c += 4) {
+		kmeter *k = km + c;
+		int lanes = nchan - c < 4 ? nchan - c : 4;
+		float tv[4], z1v[4] = {0, 0, 0, 0}, z2v[4] = {0, 0, 0, 0}, omegav[4] = {0, 0, 0, 0};
+		for (int j = 0; j < lanes; j++) {
+			kmeter_reset_rms(&k[j]);
+			omegav[j] = k[j].omega;
+			z1v[j] = k[j].z1;
+			z2v[j] = k[j].z2;
+		}
+		__m128 omega = _mm_loadu_ps(omegav);
+		__m128 omega4 = _mm_mul_ps(_mm_set1_ps(4.0f), omega);
+		__m128 z1 = _mm_loadu_ps(z1v);
+		__m128 z2 = _mm_loadu_ps(z2v);
+		__m128 t = _mm_setzero_ps();
+		for (int i = 0; i + 4 <= n; i += 4) {
+			__m128 s[4];
+			for (int j = 0; j < 4; j++) {
+				s[j] = j < lanes ? _mm_loadu_ps(p[c + j] + i) : _mm_setzero_ps();
+			}
+			_MM_TRANSPOSE4_PS(s[0], s[1], s[2], s[3]);
+			for (int j = 0; j < 4; j++) {
+				__m128 sq = _mm_mul_ps(s[j], s[j]);
+				t = _mm_max_ps(t, sq);                                  // Update digital peak.
+				z1 = _mm_add_ps(z1, _mm_mul_ps(omega, _mm_sub_ps(sq, z1))); // Update first filter.
+			}
+			z2 = _mm_add_ps(z2, _mm_mul_ps(omega4, _mm_sub_ps(z1, z2)));   // Update second filter.
+		}
+		_mm_storeu_ps(tv, t);
+		_mm_storeu_ps(z1v, z1);
+		_mm_storeu_ps(z2v, z2);
+		for (int j = 0; j < lanes; j++) kmeter_update(&k[j], tv[j], z1v[j], z2v[j]);
+	}
+#endif
+	for (; c < nchan; c++) {
+		kmeter_process(&km[c], p[c], n);
 	}
 }
 
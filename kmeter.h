@@ -24,6 +24,7 @@ typedef struct kmeter {
 void kmeter_init(kmeter *km, int fsamp, int fsize, float hold, float fall,
 				 float x, float y, float w, color c);
 void kmeter_process(kmeter *km, float *p, int n);
+void kmeter_process_multi(kmeter *km, float **p, int nchan, int n);
 void kmeter_read(kmeter *km, float *rms, float *dpk);
 void kmeter_render(kmeter *km, cairo_t *cr, float opacity);
 
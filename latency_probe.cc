@@ -0,0 +1,183 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jack/midiport.h>
+
+#include "latency_probe.h"
+
+LatencyProbe::LatencyProbe() {
+	active = 0;
+	count = 0;
+	memset(&audio, 0, sizeof(audio));
+	memset(&midi, 0, sizeof(midi));
+	finished.store(0);
+}
+
+static void series_init(latency_series *s, int count, jack_nframes_t first) {
+	s->frames = (jack_nframes_t *)calloc(count, sizeof(jack_nframes_t));
+	if (!s->frames) {
+		fprintf(stderr, "Could not allocate latency probe\n");
+		exit(1);
+	}
+	s->n = 0;
+	s->lost = 0;
+	s->pending = 0;
+	s->sent = 0;
+	s->next = first;
+}
+
+void LatencyProbe::init(jack_nframes_t sample_rate, int count) {
+	this->sample_rate = sample_rate;
+	this->count = count;
+	this->interval = PROBE_INTERVAL * sample_rate;
+	this->timeout = PROBE_TIMEOUT * sample_rate;
+	/* The first probes go out once the callback has seen a frame time,
+	 * staggered so the audio and MIDI echoes are easy to tell apart. */
+	series_init(&this->audio, count, 0);
+	series_init(&this->midi, count, this->interval / 2);
+	this->audio.pending = -1;
+	this->midi.pending = -1;
+	this->finished.store(0);
+	this->active = 1;
+}
+
+void LatencyProbe::free() {
+	this->active = 0;
+	::free(this->audio.frames);
+	::free(this->midi.frames);
+	this->audio.frames = NULL;
+	this->midi.frames = NULL;
+}
+
+int LatencyProbe::done() const {
+	return this->finished.load(std::memory_order_acquire);
+}
+
+/* Returns the offset in this period at which a probe should be sent,
+ * or -1. */
+int LatencyProbe::send_due(latency_series *s, jack_nframes_t nframes,
+						   jack_nframes_t frame_time) {
+	if (s->pending == -1) {
+		s->next += frame_time;
+		s->pending = 0;
+	}
+	if (s->pending || s->n + s->lost >= this->count) return -1;
+	int32_t off = (int32_t)(s->next - frame_time);
+	if (off >= (int32_t)nframes) return -1;
+	if (off < 0) off = 0;
+	s->sent = frame_time + off;
+	s->pending = 1;
+	return off;
+}
+
+void LatencyProbe::echo(latency_series *s, jack_nframes_t at) {
+	s->frames[s->n++] = at - s->sent;
+	s->pending = 0;
+	s->next = s->sent + this->interval;
+}
+
+void LatencyProbe::expire(latency_series *s, jack_nframes_t nframes,
+						  jack_nframes_t frame_time) {
+	if (s->pending != 1) return;
+	if ((int32_t)(frame_time + nframes - s->sent) <= (int32_t)this->timeout) return;
+	s->lost++;
+	s->pending = 0;
+	s->next = frame_time + nframes;
+}
+
+/* Called from the JACK process callback. Replaces the outputs, so
+ * nothing else reaches the loopback while measuring. */
+void LatencyProbe::process(const jack_default_audio_sample_t *in,
+						   jack_default_audio_sample_t **out, int nports,
+						   void *midi_in, void *midi_out,
+						   jack_nframes_t nframes, jack_nframes_t frame_time) {
+	int off;
+	if (!this->active) return;
+	for (int c = 0; c < nports; c++) {
+		memset(out[c], 0, sizeof(jack_default_audio_sample_t) * nframes);
+	}
+	off = this->send_due(&this->audio, nframes, frame_time);
+	if (off >= 0) out[0][off] = 1.0f;
+	if (this->audio.pending == 1) {
+		int32_t start = (int32_t)(this->audio.sent - frame_time);
+		for (int32_t i = start < 0 ? 0 : start; i < (int32_t)nframes; i++) {
+			if (fabsf(in[i]) >= PROBE_THRESHOLD) {
+				this->echo(&this->audio, frame_time + i);
+				break;
+			}
+		}
+	}
+	this->expire(&this->audio, nframes, frame_time);
+	if (midi_out) {
+		off = this->send_due(&this->midi, nframes, frame_time);
+		if (off >= 0) {
+			jack_midi_data_t on[3] = { 0x90, PROBE_NOTE, 100 };
+			jack_midi_data_t release[3] = { 0x80, PROBE_NOTE, 0 };
+			/* midi_process_output() may already have put a later
+			 * event in the buffer, which JACK will not write before;
+			 * the probe then goes out next period instead of being
+			 * counted as lost. */
+			if (jack_midi_event_write(midi_out, off, on, 3)) {
+				this->midi.pending = 0;
+			} else {
+				jack_midi_event_write(midi_out, off, release, 3);
+			}
+		}
+	}
+	if (midi_in && this->midi.pending == 1) {
+		jack_midi_event_t ev;
+		uint32_t nevents = jack_midi_get_event_count(midi_in);
+		for (uint32_t e = 0; e < nevents; e++) {
+			if (jack_midi_event_get(&ev, midi_in, e)) continue;
+			if (ev.size == 3 && (ev.buffer[0] & 0xF0) == 0x90 && ev.buffer[1] == PROBE_NOTE &&
+					(int32_t)(frame_time + ev.time - this->midi.sent) >= 0) {
+				this->echo(&this->midi, frame_time + ev.time);
+				break;
+			}
+		}
+	}
+	this->expire(&this->midi, nframes, frame_time);
+	if (this->audio.n + this->audio.lost >= this->count &&
+			(!midi_out || this->midi.n + this->midi.lost >= this->count)) {
+		this->finished.store(1, std::memory_order_release);
+	}
+}
+
+void LatencyProbe::report_series(FILE *fp, const char *name, latency_series *s) {
+	double ms = 1000.0 / this->sample_rate;
+	double sum = 0, sum2 = 0;
+	jack_nframes_t lo = 0, hi = 0;
+	if (!s->n) {
+		fprintf(fp, "%s round trip: no echo in %d probes, is the loopback connected?\n",
+				name, s->lost);
+		return;
+	}
+	for (int i = 0; i < s->n; i++) {
+		jack_nframes_t f = s->frames[i];
+		if (!i || f < lo) lo = f;
+		if (!i || f > hi) hi = f;
+		sum += f;
+		sum2 += (double)f * f;
+	}
+	double mean = sum / s->n;
+	double sd = sqrt(fmax(0, sum2 / s->n - mean * mean));
+	fprintf(fp, "%s round trip: %d of %d probes, min %u max %u mean %.1f frames"
+				" (%.2f ms), jitter %.2f ms std dev, %.2f ms peak to peak\n",
+			name, s->n, s->n + s->lost, lo, hi, mean, mean * ms, sd * ms, (hi - lo) * ms);
+}
+
+void LatencyProbe::report(FILE *fp, jack_client_t *client, jack_port_t *out_port,
+						  jack_port_t *in_port) {
+	jack_latency_range_t playback, capture;
+	jack_nframes_t period = jack_get_buffer_size(client);
+	jack_port_get_latency_range(out_port, JackPlaybackLatency, &playback);
+	jack_port_get_latency_range(in_port, JackCaptureLatency, &capture);
+	fprintf(fp, "JACK: %u Hz, %u frames per period (%.2f ms)\n",
+			this->sample_rate, period, 1000.0 * period / this->sample_rate);
+	fprintf(fp, "JACK reports playback latency %u-%u and capture latency %u-%u frames\n",
+			playback.min, playback.max, capture.min, capture.max);
+	this->report_series(fp, "audio", &this->audio);
+	if (this->midi.frames && this->midi.n + this->midi.lost) {
+		this->report_series(fp, "MIDI", &this->midi);
+	}
+}
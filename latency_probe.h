@@ -0,0 +1,54 @@
+#if !defined (_LATENCY_PROBE_H)
+#define _LATENCY_PROBE_H (1)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <jack/jack.h>
+
+#define PROBE_INTERVAL 0.1         // seconds between probes
+#define PROBE_TIMEOUT 1.0          // seconds before a probe counts as lost
+#define PROBE_THRESHOLD 0.25f      // input level that counts as the echo
+#define PROBE_NOTE 60
+
+struct latency_series {
+	jack_nframes_t *frames;    // measured round trips
+	int n;
+	int lost;
+	int pending;               // 1 while a probe waits for its echo, -1 before the first period
+	jack_nframes_t sent;       // frame time the pending probe left at
+	jack_nframes_t next;       // frame time of the next probe
+};
+
+/* Round trip latency through JACK for --measure-latency. Every
+ * PROBE_INTERVAL the JACK callback sends a one sample impulse on the
+ * first output port and a note on the MIDI output, then timestamps
+ * their echoes on the first input port and the MIDI input to the
+ * frame. Everything the callback touches is allocated by init(). */
+class LatencyProbe {
+public:
+	LatencyProbe();
+	void init(jack_nframes_t sample_rate, int count);
+	void free();
+	void process(const jack_default_audio_sample_t *in, jack_default_audio_sample_t **out,
+				 int nports, void *midi_in, void *midi_out,
+				 jack_nframes_t nframes, jack_nframes_t frame_time);
+	int done() const;
+	void report(FILE *fp, jack_client_t *client, jack_port_t *out_port,
+				jack_port_t *in_port);
+	int active;
+private:
+	int send_due(latency_series *s, jack_nframes_t nframes, jack_nframes_t frame_time);
+	void echo(latency_series *s, jack_nframes_t at);
+	void expire(latency_series *s, jack_nframes_t nframes, jack_nframes_t frame_time);
+	void report_series(FILE *fp, const char *name, latency_series *s);
+	latency_series audio;
+	latency_series midi;
+	int count;
+	jack_nframes_t sample_rate;
+	jack_nframes_t interval;
+	jack_nframes_t timeout;
+	std::atomic<int> finished;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "luma_pyramid.h"
+#include "luma_sse.h"
+
+LumaPyramid::LumaPyramid() {
+	memset(levels, 0, sizeof(levels));
+	cur = 0;
+	have_prev = 0;
+	min_level_radius = 16.0;
+}
+
+int LumaPyramid::init(int width, int height) {
+	for (int b = 0; b < 2; b++) {
+		for (int n = 0; n < PYRAMID_LEVELS; n++) {
+			luma_image *l = &this->levels[b][n];
+			l->width = width >> n;
+			l->height = height >> n;
+			l->stride = (l->width + 31) & ~31;
+			l->data = (uint8_t *)aligned_alloc(32, l->stride * l->height);
+			if (!l->data) {
+				fprintf(stderr, "Could not allocate luma pyramid\n");
+				exit(1);
+			}
+			memset(l->data, 0, l->stride * l->height);
+		}
+	}
+	this->cur = 0;
+	this->have_prev = 0;
+	return 0;
+}
+
+void LumaPyramid::free() {
+	for (int b = 0; b < 2; b++) {
+		for (int n = 0; n < PYRAMID_LEVELS; n++) {
+			::free(this->levels[b][n].data);
+			this->levels[b][n].data = NULL;
+		}
+	}
+	this->have_prev = 0;
+}
+
+void LumaPyramid::build(const uint32_t *argb, int stride) {
+	luma_image *l;
+	this->cur ^= 1;
+	l = this->levels[this->cur];
+	luma_from_argb(argb, stride, l[0].data, l[0].stride, l[0].width, l[0].height);
+	for (int n = 1; n < PYRAMID_LEVELS; n++) {
+		luma_downsample(&l[n - 1], &l[n]);
+	}
+	if (!this->have_prev) {
+		for (int n = 0; n < PYRAMID_LEVELS; n++) {
+			memcpy(this->levels[this->cur ^ 1][n].data, l[n].data,
+				   l[n].stride * l[n].height);
+		}
+		this->have_prev = 1;
+	}
+}
+
+/* Forget the previous frame, e.g. when no stage built the pyramid for
+ * a while, so the next build does not compare against a stale frame. */
+void LumaPyramid::reset() {
+	this->have_prev = 0;
+}
+
+luma_image *LumaPyramid::level(int n) {
+	return &this->levels[this->cur][n];
+}
+
+luma_image *LumaPyramid::prev_level(int n) {
+	return &this->levels[this->cur ^ 1][n];
+}
+
+double LumaPyramid::scale(int n) const {
+	return 1 << n;
+}
+
+/* The coarsest level on which a shape of radius r still covers
+ * min_level_radius pixels. */
+int LumaPyramid::level_for_radius(double r) const {
+	int n = 0;
+	while (n + 1 < PYRAMID_LEVELS && r / (1 << (n + 1)) >= this->min_level_radius) {
+		n++;
+	}
+	return n;
+}
+
+int LumaPyramid::level_for_width(int width) const {
+	int best = 0;
+	for (int n = 1; n < PYRAMID_LEVELS; n++) {
+		if (abs(this->levels[0][n].width - width) <
+				abs(this->levels[0][best].width - width)) {
+			best = n;
+		}
+	}
+	return best;
+}
+
+static inline uint8_t luma_pixel(uint32_t val) {
+	return (77 * ((val >> 16) & 0xff) + 150 * ((val >> 8) & 0xff) +
+			29 * (val & 0xff)) >> 8;
+}
+
+void luma_from_argb(const uint32_t *argb, int argb_stride, uint8_t *dst,
+					int dst_stride, int width, int height) {
+	for (int j = 0; j < height; j++) {
+		const uint32_t *src = (const uint32_t *)((const uint8_t *)argb + j * argb_stride);
+		uint8_t *d = dst + j * dst_stride;
+		int i = 0;
+#if defined(__SSE2__)
+		const __m128i w = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+		i = luma_row_sse2((const uint8_t *)src, d, width, w, _mm_setzero_si128());
+#endif
+		for (; i < width; i++) {
+			d[i] = luma_pixel(src[i]);
+		}
+	}
+}
+
+/* 2x2 box filter, rounding to nearest. */
+void luma_downsample(const luma_image *src, luma_image *dst) {
+	for (int j = 0; j < dst->height; j++) {
+		const uint8_t *r0 = src->data + 2 * j * src->stride;
+		const uint8_t *r1 = r0 + src->stride;
+		uint8_t *d = dst->data + j * dst->stride;
+		int i = 0;
+#if defined(__SSE2__)
+		const __m128i mask = _mm_set1_epi16(0x00ff);
+		const __m128i two = _mm_set1_epi16(2);
+		for (; i + 16 <= dst->width; i += 16) {
+			__m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + 2 * i));
+			__m128i a1 = _mm_loadu_si128((const __m128i *)(r0 + 2 * i + 16));
+			__m128i b0 = _mm_loadu_si128((const __m128i *)(r1 + 2 * i));
+			__m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + 2 * i + 16));
+			__m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, mask), _mm_srli_epi16(a0, 8)),
+									   _mm_add_epi16(_mm_and_si128(b0, mask), _mm_srli_epi16(b0, 8)));
+			__m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, mask), _mm_srli_epi16(a1, 8)),
+									   _mm_add_epi16(_mm_and_si128(b1, mask), _mm_srli_epi16(b1, 8)));
+			s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+			s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+			_mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(s0, s1));
+		}
+#endif
+		for (; i < dst->width; i++) {
+			d[i] = (r0[2 * i] + r0[2 * i + 1] + r1[2 * i] + r1[2 * i + 1] + 2) >> 2;
+		}
+	}
+}
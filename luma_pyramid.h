@@ -0,0 +1,41 @@
+#if !defined (_LUMA_PYRAMID_H)
+#define _LUMA_PYRAMID_H (1)
+
+#include <stdint.h>
+
+#define PYRAMID_LEVELS 4
+
+typedef struct luma_image {
+	uint8_t *data;
+	int width;
+	int height;
+	int stride;
+} luma_image;
+
+/* Per-frame luma planes at full, 1/2, 1/4 and 1/8 resolution, built
+ * once from the composited sources and kept for one frame so the
+ * analysis stages can compare against the previous frame. */
+class LumaPyramid {
+public:
+	LumaPyramid();
+	int init(int width, int height);
+	void free();
+	void build(const uint32_t *argb, int stride);
+	void reset();
+	luma_image *level(int n);
+	luma_image *prev_level(int n);
+	int level_for_radius(double r) const;
+	int level_for_width(int width) const;
+	double scale(int n) const;
+	double min_level_radius;
+	int have_prev;
+private:
+	luma_image levels[2][PYRAMID_LEVELS];
+	int cur;
+};
+
+void luma_from_argb(const uint32_t *argb, int argb_stride, uint8_t *dst,
+					int dst_stride, int width, int height);
+void luma_downsample(const luma_image *src, luma_image *dst);
+
+#endif
@@ -0,0 +1,41 @@
+#if !defined (_LUMA_SSE_H)
+#define _LUMA_SSE_H (1)
+
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Weighted BGRA to 8 bit luma, shared by the motion pyramid and the
+ * recorder's YUV conversion, which differ only in weights and bias.
+ * w holds the B, G, R and zero weights twice; each luma is
+ * (w . bgra + bias) >> 8. */
+static inline __m128i luma4_sse2(__m128i px, __m128i w, __m128i bias) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), w);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), w);
+	lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_add_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+	hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+	return _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi64(lo, hi), bias), 8);
+}
+
+/* Converts the whole groups of sixteen pixels in a row and returns how
+ * many pixels that was, leaving the rest to scalar code. */
+static inline int luma_row_sse2(const uint8_t *src, uint8_t *dst, int width,
+								__m128i w, __m128i bias) {
+	int i = 0;
+	for (; i + 16 <= width; i += 16) {
+		__m128i l0 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i)), w, bias);
+		__m128i l1 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), w, bias);
+		__m128i l2 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i + 32)), w, bias);
+		__m128i l3 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i + 48)), w, bias);
+		_mm_storeu_si128((__m128i *)(dst + i),
+						 _mm_packus_epi16(_mm_packs_epi32(l0, l1),
+										  _mm_packs_epi32(l2, l3)));
+	}
+	return i;
+}
+#endif
+
+#endif
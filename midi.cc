@@ -1,17 +1,95 @@
 #include "midi.h"
 
-static void queue_message(DingleDots *dd, struct midi_message *ev) {
+static int queue_message(DingleDots *dd, struct midi_message *ev) {
 	int written;
 	if (jack_ringbuffer_write_space(dd->midi_ring_buf) < sizeof(*ev)) {
 		fprintf(stderr, "Not enough space in the ringbuffer, NOTE LOST.");
-		return;
+		return 0;
 	}
 	written = jack_ringbuffer_write(dd->midi_ring_buf, (char *)ev, sizeof(*ev));
-	if (written != sizeof(*ev))
+	if (written != sizeof(*ev)) {
 		fprintf(stderr, "jack_ringbuffer_write failed, NOTE LOST.");
+		return 0;
+	}
+	return 1;
+}
+
+/* Controller changes are coalesced on the JACK side, so when the ring is
+ * full dropping one only delays the value until the next change. */
+static int queue_control(DingleDots *dd, struct midi_message *ev) {
+	if (jack_ringbuffer_write_space(dd->midi_cc_ring_buf) < sizeof(*ev)) {
+		dd->midi_cc_dropped++;
+		return 0;
+	}
+	jack_ringbuffer_write(dd->midi_cc_ring_buf, (char *)ev, sizeof(*ev));
+	return 1;
 }
 
-void midi_queue_new_message(int b0, int b1, int b2, DingleDots *dd) {
+/* Note offs are never dropped: whatever does not fit in their ring
+ * waits here, in order, for midi_flush_note_offs(). */
+static void queue_note_off(DingleDots *dd, struct midi_message *ev) {
+	midi_flush_note_offs(dd);
+	if (dd->midi_off_backlog.empty() &&
+			jack_ringbuffer_write_space(dd->midi_off_ring_buf) >= sizeof(*ev)) {
+		jack_ringbuffer_write(dd->midi_off_ring_buf, (char *)ev, sizeof(*ev));
+	} else {
+		dd->midi_off_backlog.push_back(*ev);
+	}
+}
+
+void midi_flush_note_offs(DingleDots *dd) {
+	size_t n = 0;
+	while (n < dd->midi_off_backlog.size() &&
+		   jack_ringbuffer_write_space(dd->midi_off_ring_buf) >= sizeof(struct midi_message)) {
+		jack_ringbuffer_write(dd->midi_off_ring_buf, (char *)&dd->midi_off_backlog[n],
+							  sizeof(struct midi_message));
+		n++;
+	}
+	dd->midi_off_backlog.erase(dd->midi_off_backlog.begin(),
+							   dd->midi_off_backlog.begin() + n);
+}
+
+/* Events queued until the next call are taken to have happened at ts,
+ * a CLOCK_MONOTONIC time such as the capture time of the camera frame
+ * that triggered them. NULL means the moment they are queued. */
+void midi_set_event_time(DingleDots *dd, struct timespec *ts) {
+	if (ts) {
+		dd->midi_event_ts = *ts;
+	} else {
+		dd->midi_event_ts.tv_sec = 0;
+		dd->midi_event_ts.tv_nsec = 0;
+	}
+}
+
+/* JACK frame time at which an event should sound: midi_latency after
+ * it happened. JACK's clock is not necessarily CLOCK_MONOTONIC, so the
+ * event's age is measured on the monotonic clock and taken off
+ * jack_get_time(). Times never go backwards, because the output side
+ * stops at the first event that belongs to a later period. */
+jack_nframes_t midi_event_frame_time(DingleDots *dd) {
+	struct timespec now;
+	struct timespec *ts = &dd->midi_event_ts;
+	int64_t delay = dd->midi_latency * 1000000;
+	jack_nframes_t t;
+	if (ts->tv_sec || ts->tv_nsec) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t age = (now.tv_sec - ts->tv_sec) * 1000000LL +
+				(now.tv_nsec - ts->tv_nsec) / 1000;
+		if (age > 0) delay -= age;
+	}
+	t = jack_time_to_frames(dd->client, (int64_t)jack_get_time() + delay);
+	if ((int32_t)(dd->midi_last_time - jack_frame_time(dd->client)) > 0 &&
+			(int32_t)(t - dd->midi_last_time) < 0) {
+		t = dd->midi_last_time;
+	}
+	dd->midi_last_time = t;
+	return t;
+}
+
+/* Queues an event to sound at JACK frame time, as returned by
+ * midi_event_frame_time(), so callers that also play it on the synth
+ * can give both the same time. Returns 0 if the event was dropped. */
+int midi_queue_message_at(int b0, int b1, int b2, jack_nframes_t time, DingleDots *dd) {
 	struct midi_message ev;
 	if (b1 == -1) {
 		ev.len = 1;
@@ -26,42 +104,236 @@ void midi_queue_new_message(int b0, int b1, int b2, DingleDots *dd) {
 		ev.data[1] = b1;
 		ev.data[2] = b2;
 	}
-	ev.time = jack_frame_time(dd->client);
-	queue_message(dd, &ev);
+	ev.time = time;
+	ev.seq = dd->midi_seq++;
+	switch (b0 & 0xF0) {
+		case 0x80:
+			queue_note_off(dd, &ev);
+			return 1;
+		case 0x90:
+			if (ev.len == 3 && ev.data[2] == 0) {
+				queue_note_off(dd, &ev);
+				return 1;
+			}
+			return queue_message(dd, &ev);
+		case 0xB0:
+		case 0xD0:
+		case 0xE0:
+			return queue_control(dd, &ev);
+		default:
+			return queue_message(dd, &ev);
+	}
+}
+
+int midi_queue_new_message(int b0, int b1, int b2, DingleDots *dd) {
+	return midi_queue_message_at(b0, b1, b2, midi_event_frame_time(dd), dd);
+}
+
+/* Maps a shape's motion score onto the continuous outputs that are
+ * enabled: silent at the motion threshold, full scale at
+ * MIDI_MOTION_RANGE times it, logarithmic in between. Only changed
+ * values are queued, and a value only counts as sent once it is in the
+ * queue, so a dropped change goes out again on the next call. */
+void midi_send_motion(DingleDots *dd, SoundShape *ss, double score) {
+	double f = 0;
+	int value;
+	if (score > dd->motion_threshold) {
+		f = log(score / dd->motion_threshold) / log(MIDI_MOTION_RANGE);
+		if (f > 1) f = 1;
+	}
+	if (dd->motion_cc >= 0) {
+		value = lround(f * 127);
+		if (value != ss->motion_cc_value &&
+				midi_queue_new_message(0xB0 | ss->midi_channel, dd->motion_cc, value, dd)) {
+			ss->motion_cc_value = value;
+		}
+	}
+	if (dd->motion_bend) {
+		value = 8192 + lround(f * 8191);
+		if (value != ss->motion_bend_value &&
+				midi_queue_new_message(0xE0 | ss->midi_channel, value & 0x7F, value >> 7, dd)) {
+			ss->motion_bend_value = value;
+		}
+	}
+	if (dd->motion_pressure) {
+		value = lround(f * 127);
+		if (value != ss->motion_pressure_value &&
+				midi_queue_new_message(0xD0 | ss->midi_channel, value, -1, dd)) {
+			ss->motion_pressure_value = value;
+		}
+	}
+}
+
+/* Whether rb holds an event due before the end of this period. */
+static int next_event(jack_ringbuffer_t *rb, struct midi_message *ev,
+					  jack_nframes_t last_frame_time, jack_nframes_t nframes) {
+	if (jack_ringbuffer_read_space(rb) < sizeof(*ev)) return 0;
+	jack_ringbuffer_peek(rb, (char *)ev, sizeof(*ev));
+	return (int32_t)(ev->time - last_frame_time) < (int32_t)nframes;
+}
+
+/* Folds this period's controller changes into the table. */
+static void collect_controls(DingleDots *dd, jack_nframes_t last_frame_time,
+							 jack_nframes_t nframes) {
+	struct midi_cc_table *tab = &dd->midi_ccs;
+	struct midi_message ev;
+	int ctl, value, idx;
+	while (next_event(dd->midi_cc_ring_buf, &ev, last_frame_time, nframes)) {
+		jack_ringbuffer_read_advance(dd->midi_cc_ring_buf, sizeof(ev));
+		switch (ev.data[0] & 0xF0) {
+			case 0xB0:
+				ctl = ev.data[1] & 0x7F;
+				value = ev.data[2];
+				break;
+			case 0xD0:
+				ctl = MIDI_PRESSURE;
+				value = ev.data[1];
+				break;
+			default:
+				ctl = MIDI_PITCH_BEND;
+				value = (ev.data[2] << 7) | ev.data[1];
+		}
+		idx = (ev.data[0] & 0x0F) * MIDI_NUM_CONTROLS + ctl;
+		tab->value[idx] = value;
+		if (!tab->dirty[idx]) {
+			tab->dirty[idx] = 1;
+			tab->pending[tab->npending++] = idx;
+		}
+	}
+}
+
+/* Offsets in this period of the MIDI clock ticks due, MIDI_CLOCK_PPQN
+ * to a beat and in phase with the beat tracker's newest beat. A tick
+ * too close to the last one sent is skipped, so moving the grid never
+ * doubles a tick; one the port buffer had no room for does not count
+ * as sent. Returns -1 while there is no beat to follow. */
+static int clock_ticks(DingleDots *dd, jack_nframes_t last_frame_time,
+					   jack_nframes_t nframes, int *ticks) {
+	jack_nframes_t beat_time;
+	double period, tick, since, at;
+	int n = 0;
+	if (!dd->midi_clock || !dd->beats.clock(&beat_time, &period)) return -1;
+	tick = period / MIDI_CLOCK_PPQN;
+	since = (int32_t)(last_frame_time - beat_time);
+	at = ceil(since / tick) * tick - since;
+	for (; at < nframes && n < MIDI_MAX_CLOCK_TICKS; at += tick) {
+		int offset = at < 0 ? 0 : (int)at;
+		jack_nframes_t t = last_frame_time + offset;
+		if (dd->midi_clock_started && (int32_t)(t - dd->midi_clock_last) < tick / 2) continue;
+		ticks[n++] = offset;
+	}
+	return n;
 }
 
+/* A clock tick, preceded by a start the first time. */
+static void send_clock(DingleDots *dd, void *port_buffer, jack_nframes_t last_frame_time,
+					   int t) {
+	unsigned char *buffer;
+	if (!dd->midi_clock_started) {
+		buffer = jack_midi_event_reserve(port_buffer, t, 1);
+		if (!buffer) return;
+		buffer[0] = 0xFA;
+		dd->midi_clock_started = 1;
+	}
+	buffer = jack_midi_event_reserve(port_buffer, t, 1);
+	if (!buffer) return;
+	buffer[0] = 0xF8;
+	dd->midi_clock_last = last_frame_time + t;
+}
+
+/* A stop at the start of the period once the clock has lost the beat
+ * or been turned off. If the port buffer is full it goes next period. */
+static void stop_clock(DingleDots *dd, void *port_buffer) {
+	unsigned char *buffer;
+	if (!dd->midi_clock_started) return;
+	buffer = jack_midi_event_reserve(port_buffer, 0, 1);
+	if (!buffer) return;
+	buffer[0] = 0xFC;
+	dd->midi_clock_started = 0;
+}
+
+/* Note events go out first, in the order they were queued and merged
+ * with the clock ticks, then one message per changed controller. Anything the
+ * port buffer cannot take stays queued for the next period. */
 void midi_process_output(jack_nframes_t nframes, DingleDots *dd) {
-	int read, t;
+	int t, last_t = 0;
+	int have_note, have_off;
+	int ticks[MIDI_MAX_CLOCK_TICKS];
+	int nticks, tick = 0;
 	unsigned char *buffer;
 	void *port_buffer;
 	jack_nframes_t last_frame_time;
-	struct midi_message ev;
+	struct midi_message note, off, *ev;
+	jack_ringbuffer_t *rb;
+	struct midi_cc_table *tab = &dd->midi_ccs;
 	last_frame_time = jack_last_frame_time(dd->client);
 	port_buffer = jack_port_get_buffer(dd->midi_port, nframes);
 	if (port_buffer == NULL) {
 		return;
 	}
 	jack_midi_clear_buffer(port_buffer);
-	while (jack_ringbuffer_read_space(dd->midi_ring_buf)) {
-		read = jack_ringbuffer_peek(dd->midi_ring_buf, (char *)&ev, sizeof(ev));
-		if (read != sizeof(ev)) {
-			jack_ringbuffer_read_advance(dd->midi_ring_buf, read);
-			continue;
+	nticks = clock_ticks(dd, last_frame_time, nframes, ticks);
+	if (nticks < 0) {
+		stop_clock(dd, port_buffer);
+		nticks = 0;
+	}
+	for (;;) {
+		have_note = next_event(dd->midi_ring_buf, &note, last_frame_time, nframes);
+		have_off = next_event(dd->midi_off_ring_buf, &off, last_frame_time, nframes);
+		if (!have_note && !have_off) break;
+		if (have_off && (!have_note || (int32_t)(off.time - note.time) < 0 ||
+						 (off.time == note.time && (int32_t)(off.seq - note.seq) < 0))) {
+			ev = &off;
+			rb = dd->midi_off_ring_buf;
+		} else {
+			ev = &note;
+			rb = dd->midi_ring_buf;
 		}
-		t = ev.time + nframes - last_frame_time;
-		/* If computed time is too much into
-	 * the future, we'll need
-	 *       to send it later. */
-		if (t >= (int)nframes)
-			break;
-		/* If computed time is < 0, we
-	 * missed a cycle because of xrun.
-	 * */
-		if (t < 0)
-			t = 0;
-		jack_ringbuffer_read_advance(dd->midi_ring_buf, sizeof(ev));
-		buffer = jack_midi_event_reserve(port_buffer, t, ev.len);
-		memcpy(buffer, ev.data, ev.len);
+		t = (int32_t)(ev->time - last_frame_time);
+		/* An event due before the last one sent came later than
+		 * midi_latency allowed, or we missed a cycle because of
+		 * an xrun. */
+		if (t < last_t)
+			t = last_t;
+		for (; tick < nticks && ticks[tick] <= t; tick++) {
+			send_clock(dd, port_buffer, last_frame_time,
+					   ticks[tick] < last_t ? last_t : ticks[tick]);
+		}
+		buffer = jack_midi_event_reserve(port_buffer, t, ev->len);
+		if (!buffer) break;
+		memcpy(buffer, ev->data, ev->len);
+		jack_ringbuffer_read_advance(rb, sizeof(*ev));
+		last_t = t;
+	}
+	collect_controls(dd, last_frame_time, nframes);
+	int sent = 0;
+	for (; sent < tab->npending; sent++) {
+		int idx = tab->pending[sent];
+		int channel = idx / MIDI_NUM_CONTROLS;
+		int ctl = idx % MIDI_NUM_CONTROLS;
+		int value = tab->value[idx];
+		int len = ctl == MIDI_PRESSURE ? 2 : 3;
+		buffer = jack_midi_event_reserve(port_buffer, last_t, len);
+		if (!buffer) break;
+		if (ctl == MIDI_PITCH_BEND) {
+			buffer[0] = 0xE0 | channel;
+			buffer[1] = value & 0x7F;
+			buffer[2] = value >> 7;
+		} else if (ctl == MIDI_PRESSURE) {
+			buffer[0] = 0xD0 | channel;
+			buffer[1] = value;
+		} else {
+			buffer[0] = 0xB0 | channel;
+			buffer[1] = ctl;
+			buffer[2] = value;
+		}
+		tab->dirty[idx] = 0;
+	}
+	memmove(tab->pending, tab->pending + sent, sizeof(tab->pending[0]) * (tab->npending - sent));
+	tab->npending -= sent;
+	for (; tick < nticks; tick++) {
+		send_clock(dd, port_buffer, last_frame_time,
+				   ticks[tick] < last_t ? last_t : ticks[tick]);
 	}
 }
 
@@ -6,12 +6,18 @@
 #include <jack/ringbuffer.h>
 #include <jack/midiport.h>
 #include "v4l2_wayland.h"
+#include "midi_types.h"
 #include "dingle_dots.h"
 
-#define MAX_SCALE_LENGTH 64
+#define MIDI_DEFAULT_LATENCY 0.05  // seconds from camera capture to the note sounding
+#define MIDI_OFF_RB_SIZE 256 * sizeof(struct midi_message)  // two per sound shape
+#define MIDI_CC_RB_SIZE 1024 * sizeof(struct midi_message)
+#define MIDI_MOTION_RANGE 100.0    // motion score over threshold for full scale output
+#define MIDI_CLOCK_PPQN 24
+#define MIDI_MAX_CLOCK_TICKS 64    // per period
 
-typedef struct midi_key_t midi_key_t;
 class DingleDots;
+class SoundShape;
 
 typedef enum {
 	MAJOR = 0,
@@ -20,21 +26,12 @@ typedef enum {
 	SINGLE
 } scales;
 
-struct midi_message {
-	jack_nframes_t time;
-	int len; /*Bytes.*/
-	unsigned char data[3];
-};
-
-struct midi_key_t {
-	uint8_t base_note;
-	int scaleid;
-	int steps[MAX_SCALE_LENGTH];
-	int num_steps;
-	int channel;
-};
-
-void midi_queue_new_message(int b0, int b1, int b2, DingleDots *dd);
+void midi_set_event_time(DingleDots *dd, struct timespec *ts);
+jack_nframes_t midi_event_frame_time(DingleDots *dd);
+int midi_queue_message_at(int b0, int b1, int b2, jack_nframes_t time, DingleDots *dd);
+int midi_queue_new_message(int b0, int b1, int b2, DingleDots *dd);
+void midi_flush_note_offs(DingleDots *dd);
+void midi_send_motion(DingleDots *dd, SoundShape *ss, double score);
 void midi_process_output(jack_nframes_t nframes, DingleDots *dd);
 float midi_to_freq(int midi_note);
 void midi_key_init_by_scale_id(midi_key_t *key, uint8_t base_note, int scaleid);
@@ -0,0 +1,39 @@
+#if !defined (_MIDI_TYPES_H)
+#define _MIDI_TYPES_H (1)
+
+#include <stdint.h>
+#include <jack/types.h>
+
+#define MAX_SCALE_LENGTH 64
+#define MIDI_NUM_CONTROLS 130      // 128 CCs, then pitch bend and channel pressure
+#define MIDI_PITCH_BEND 128
+#define MIDI_PRESSURE 129
+
+/* The MIDI structs DingleDots holds by value, apart from midi.h so that
+ * dingle_dots.h and midi.h can each include the other's header. */
+struct midi_message {
+	jack_nframes_t time;
+	uint32_t seq;     /* queue order, for events due at the same frame */
+	int len; /*Bytes.*/
+	unsigned char data[3];
+};
+
+/* Latest value of every controller on every channel, written only by
+ * the JACK callback. Each controller that changed during a period is
+ * listed once in pending and sent once, with its newest value. */
+struct midi_cc_table {
+	uint16_t value[16 * MIDI_NUM_CONTROLS];
+	uint8_t dirty[16 * MIDI_NUM_CONTROLS];
+	uint16_t pending[16 * MIDI_NUM_CONTROLS];
+	int npending;
+};
+
+typedef struct midi_key_t {
+	uint8_t base_note;
+	int scaleid;
+	int steps[MAX_SCALE_LENGTH];
+	int num_steps;
+	int channel;
+} midi_key_t;
+
+#endif
@@ -0,0 +1,173 @@
+#include <math.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mixer.h"
+
+/* dst[i] += gain * src[i] */
+static void add_scaled(jack_default_audio_sample_t *dst, const jack_default_audio_sample_t *src,
+					   float gain, jack_nframes_t nframes) {
+	jack_nframes_t i = 0;
+#if defined(__SSE2__)
+	const __m128 g = _mm_set1_ps(gain);
+	for (; i + 4 <= nframes; i += 4) {
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+										  _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	}
+#endif
+	for (; i < nframes; i++) {
+		dst[i] += gain * src[i];
+	}
+}
+
+/* out[c][i] += gain * in[i * src_chans + c] for nframes whole frames.
+ * Stereo is deinterleaved with shuffles; other channel counts copy each
+ * channel out a block at a time and scale it in with add_scaled(), so
+ * the cost stays linear in the channels and vectorised either way. */
+static void accumulate(const float *in, int src_chans, float gain,
+					   jack_default_audio_sample_t **out, int nports,
+					   jack_nframes_t offset, jack_nframes_t nframes) {
+	jack_nframes_t i = 0;
+	int nchans = src_chans < nports ? src_chans : nports;
+#if defined(__SSE2__)
+	if (src_chans == 2 && nports >= 2) {
+		const __m128 g = _mm_set1_ps(gain);
+		float *l = out[0] + offset;
+		float *r = out[1] + offset;
+		for (; i + 4 <= nframes; i += 4) {
+			__m128 a = _mm_loadu_ps(in + 2 * i);        // l0 r0 l1 r1
+			__m128 b = _mm_loadu_ps(in + 2 * i + 4);    // l2 r2 l3 r3
+			__m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(l + i, _mm_add_ps(_mm_loadu_ps(l + i), _mm_mul_ps(left, g)));
+			_mm_storeu_ps(r + i, _mm_add_ps(_mm_loadu_ps(r + i), _mm_mul_ps(right, g)));
+		}
+		for (; i < nframes; i++) {
+			l[i] += gain * in[2 * i];
+			r[i] += gain * in[2 * i + 1];
+		}
+		return;
+	}
+#endif
+	if (nframes < MIXER_BLOCK) {
+		for (; i < nframes; i++) {
+			for (int c = 0; c < nchans; c++) {
+				out[c][offset + i] += gain * in[i * src_chans + c];
+			}
+		}
+		return;
+	}
+	float block[MIXER_BLOCK];
+	for (int c = 0; c < nchans; c++) {
+		for (i = 0; i < nframes; i += MIXER_BLOCK) {
+			jack_nframes_t n = nframes - i < MIXER_BLOCK ? nframes - i : MIXER_BLOCK;
+			const float *src = in + i * src_chans + c;
+			for (jack_nframes_t k = 0; k < n; k++) {
+				block[k] = src[k * src_chans];
+			}
+			add_scaled(out[c] + offset + i, block, gain, n);
+		}
+	}
+}
+
+/* Returns the number of frames mixed. */
+jack_nframes_t mixer_add_source(jack_ringbuffer_t *rb, int src_chans, float gain,
+								jack_default_audio_sample_t **out, int nports,
+								jack_nframes_t nframes) {
+	jack_ringbuffer_data_t vec[2];
+	const size_t frame_size = sizeof(float) * src_chans;
+	if (src_chans > MIXER_MAX_SOURCE_CHANNELS) return 0;
+	jack_ringbuffer_get_read_vector(rb, vec);
+	jack_nframes_t avail = (vec[0].len + vec[1].len) / frame_size;
+	jack_nframes_t n = avail < nframes ? avail : nframes;
+	jack_nframes_t n0 = vec[0].len / frame_size;
+	if (n0 > n) n0 = n;
+	accumulate((const float *)vec[0].buf, src_chans, gain, out, nports, 0, n0);
+	if (n0 < n) {
+		/* A frame may straddle the two segments when the frame size
+		 * does not divide the ring size; copy that one frame. */
+		size_t split = vec[0].len - n0 * frame_size;
+		size_t rest = frame_size - split;
+		const char *tail = vec[1].buf + rest;
+		if (split) {
+			float frame[MIXER_MAX_SOURCE_CHANNELS];
+			const char *head = vec[0].buf + n0 * frame_size;
+			for (size_t b = 0; b < split; b++) ((char *)frame)[b] = head[b];
+			for (size_t b = 0; b < rest; b++) ((char *)frame)[split + b] = vec[1].buf[b];
+			accumulate(frame, src_chans, gain, out, nports, n0, 1);
+			n0++;
+		} else {
+			tail = vec[1].buf;
+		}
+		accumulate((const float *)tail, src_chans, gain, out, nports, n0, n - n0);
+	}
+	jack_ringbuffer_read_advance(rb, n * frame_size);
+	return n;
+}
+
+/* Replaces every output with its routed mix of the inputs. */
+void mixer_apply_routes(jack_default_audio_sample_t **in, jack_default_audio_sample_t **out,
+						int nout, const mixer_route *routes, int nroutes, jack_nframes_t nframes) {
+	for (int c = 0; c < nout; c++) {
+		memset(out[c], 0, sizeof(jack_default_audio_sample_t) * nframes);
+	}
+	for (int r = 0; r < nroutes; r++) {
+		add_scaled(out[routes[r].out], in[routes[r].in], routes[r].gain, nframes);
+	}
+}
+
+static float peak(const jack_default_audio_sample_t *buf, jack_nframes_t nframes) {
+	float p = 0.0f;
+	jack_nframes_t i = 0;
+#if defined(__SSE2__)
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 m = _mm_setzero_ps();
+	for (; i + 4 <= nframes; i += 4) {
+		m = _mm_max_ps(m, _mm_andnot_ps(sign_mask, _mm_loadu_ps(buf + i)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, m);
+	p = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+	for (; i < nframes; i++) {
+		p = fmaxf(p, fabsf(buf[i]));
+	}
+	return p;
+}
+
+/* Leaves a period that stays within full scale untouched, so unity gain
+ * material passes through bit exact. A period that goes over is unity
+ * below MIXER_CLIP_KNEE, then a rational curve that approaches full
+ * scale without ever reaching it. */
+void mixer_soft_clip(jack_default_audio_sample_t *buf, jack_nframes_t nframes) {
+	if (peak(buf, nframes) <= 1.0f) return;
+	const float knee = MIXER_CLIP_KNEE;
+	const float room = 1.0f - MIXER_CLIP_KNEE;
+	jack_nframes_t i = 0;
+#if defined(__SSE2__)
+	const __m128 vknee = _mm_set1_ps(knee);
+	const __m128 vroom = _mm_set1_ps(room);
+	const __m128 vinv_room = _mm_set1_ps(1.0f / room);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	for (; i + 4 <= nframes; i += 4) {
+		__m128 x = _mm_loadu_ps(buf + i);
+		__m128 sign = _mm_and_ps(x, sign_mask);
+		__m128 ax = _mm_andnot_ps(sign_mask, x);
+		__m128 over = _mm_cmpgt_ps(ax, vknee);
+		if (!_mm_movemask_ps(over)) continue;
+		__m128 e = _mm_mul_ps(_mm_sub_ps(ax, vknee), vinv_room);
+		__m128 y = _mm_add_ps(vknee, _mm_mul_ps(vroom, _mm_div_ps(e, _mm_add_ps(one, e))));
+		y = _mm_or_ps(y, sign);
+		_mm_storeu_ps(buf + i, _mm_or_ps(_mm_and_ps(over, y), _mm_andnot_ps(over, x)));
+	}
+#endif
+	for (; i < nframes; i++) {
+		float ax = fabsf(buf[i]);
+		if (ax <= knee) continue;
+		float e = (ax - knee) / room;
+		buf[i] = copysignf(knee + room * e / (1.0f + e), buf[i]);
+	}
+}
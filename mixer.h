@@ -0,0 +1,33 @@
+#if !defined (_MIXER_H)
+#define _MIXER_H (1)
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#define MIXER_CLIP_KNEE 0.8f    // soft clipping starts above this level
+#define MIXER_MAX_SOURCE_CHANNELS 16
+#define MIXER_BLOCK 64          // frames deinterleaved at a time
+
+/* Real time safe helpers for mixing interleaved file audio into the
+ * JACK output buffers. mixer_add_source() takes up to one period from a
+ * source ring in at most two bulk passes over its read vector; a source
+ * that runs short simply leaves the tail of the period untouched, which
+ * is silence in the mix. */
+jack_nframes_t mixer_add_source(jack_ringbuffer_t *rb, int src_chans, float gain,
+								jack_default_audio_sample_t **out, int nports,
+								jack_nframes_t nframes);
+void mixer_soft_clip(jack_default_audio_sample_t *buf, jack_nframes_t nframes);
+
+/* One nonzero entry of the input to output mix matrix. Only these are
+ * visited, so the cost grows with the number of routes rather than
+ * with inputs times outputs. */
+struct mixer_route {
+	int in;
+	int out;
+	float gain;
+};
+
+void mixer_apply_routes(jack_default_audio_sample_t **in, jack_default_audio_sample_t **out,
+						int nout, const mixer_route *routes, int nroutes, jack_nframes_t nframes);
+
+#endif
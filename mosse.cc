@@ -0,0 +1,225 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mosse.h"
+#include "fft_plans.h"
+
+MosseTracker::MosseTracker() {
+	active = 0;
+	patch = window = response = b = NULL;
+	spec = prod = g = a = NULL;
+	forward = inverse = NULL;
+}
+
+static inline int clamp(int v, int lo, int hi) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static int window_size(int n) {
+	int size = MOSSE_MIN_SIZE;
+	while (size < n && size < MOSSE_MAX_SIZE) size <<= 1;
+	return size;
+}
+
+#define MOSSE_NSIZES 4             // MOSSE_MIN_SIZE to MOSSE_MAX_SIZE in powers of two
+
+/* One pair of plans per window size, measured the first time a tracker
+ * uses that size and then shared by every tracker through the new-array
+ * execute functions, so starting a tracker does no planning after that.
+ * fftw_alloc_* keeps every tracker's arrays aligned like the scratch
+ * arrays the plans were made on. */
+static fftw_plan forward_plans[MOSSE_NSIZES][MOSSE_NSIZES];
+static fftw_plan inverse_plans[MOSSE_NSIZES][MOSSE_NSIZES];
+
+static int size_index(int size) {
+	int i = 0;
+	while ((MOSSE_MIN_SIZE << i) < size) i++;
+	return i;
+}
+
+static void get_plans(int w, int h, fftw_plan *forward, fftw_plan *inverse) {
+	int i = size_index(w);
+	int j = size_index(h);
+	fft_plan_lock();
+	if (!forward_plans[j][i]) {
+		double *real = fftw_alloc_real(w * h);
+		fftw_complex *spec = fftw_alloc_complex(h * (w / 2 + 1));
+		if (!real || !spec) {
+			fprintf(stderr, "Could not allocate correlation tracker\n");
+			exit(1);
+		}
+		forward_plans[j][i] = fftw_plan_dft_r2c_2d(h, w, real, spec, FFTW_MEASURE);
+		inverse_plans[j][i] = fftw_plan_dft_c2r_2d(h, w, spec, real, FFTW_MEASURE);
+		fftw_free(real);
+		fftw_free(spec);
+	}
+	*forward = forward_plans[j][i];
+	*inverse = inverse_plans[j][i];
+	fft_plan_unlock();
+}
+
+int MosseTracker::init(const luma_image *frame, int x, int y, int w, int h) {
+	this->free();
+	this->box_width = w;
+	this->box_height = h;
+	this->cx = x + 0.5 * w;
+	this->cy = y + 0.5 * h;
+	this->win_width = window_size(w);
+	this->win_height = window_size(h);
+	this->spec_size = this->win_height * (this->win_width / 2 + 1);
+	int n = this->win_width * this->win_height;
+	this->patch = fftw_alloc_real(n);
+	this->window = fftw_alloc_real(n);
+	this->response = fftw_alloc_real(n);
+	this->b = fftw_alloc_real(this->spec_size);
+	this->spec = fftw_alloc_complex(this->spec_size);
+	this->prod = fftw_alloc_complex(this->spec_size);
+	this->g = fftw_alloc_complex(this->spec_size);
+	this->a = fftw_alloc_complex(this->spec_size);
+	if (!this->patch || !this->window || !this->response || !this->b ||
+			!this->spec || !this->prod || !this->g || !this->a) {
+		fprintf(stderr, "Could not allocate correlation tracker\n");
+		exit(1);
+	}
+	/* train() blends into a and b even at rate 1, so they have to
+	 * start at zero rather than whatever fftw_alloc returned. */
+	memset(this->a, 0, sizeof(fftw_complex) * this->spec_size);
+	memset(this->b, 0, sizeof(double) * this->spec_size);
+	get_plans(this->win_width, this->win_height, &this->forward, &this->inverse);
+	for (int v = 0; v < 256; v++) {
+		this->log_table[v] = log(1.0 + v);
+	}
+	for (int j = 0; j < this->win_height; j++) {
+		double wy = 0.5 * (1 - cos(2 * M_PI * j / (this->win_height - 1)));
+		for (int i = 0; i < this->win_width; i++) {
+			double wx = 0.5 * (1 - cos(2 * M_PI * i / (this->win_width - 1)));
+			this->window[i + j * this->win_width] = wx * wy;
+		}
+	}
+	/* The desired response is a Gaussian peak at the window centre. */
+	for (int j = 0; j < this->win_height; j++) {
+		double dy = j - this->win_height / 2;
+		for (int i = 0; i < this->win_width; i++) {
+			double dx = i - this->win_width / 2;
+			this->patch[i + j * this->win_width] =
+					exp(-(dx * dx + dy * dy) / (2 * MOSSE_SIGMA * MOSSE_SIGMA));
+		}
+	}
+	fftw_execute_dft_r2c(this->forward, this->patch, this->spec);
+	memcpy(this->g, this->spec, sizeof(fftw_complex) * this->spec_size);
+	this->preprocess(frame);
+	this->train(1.0);
+	this->psr = 0;
+	this->active = 1;
+	return 0;
+}
+
+void MosseTracker::free() {
+	this->forward = this->inverse = NULL;
+	fftw_free(this->patch);
+	fftw_free(this->window);
+	fftw_free(this->response);
+	fftw_free(this->b);
+	fftw_free(this->spec);
+	fftw_free(this->prod);
+	fftw_free(this->g);
+	fftw_free(this->a);
+	this->patch = this->window = this->response = this->b = NULL;
+	this->spec = this->prod = this->g = this->a = NULL;
+	this->active = 0;
+}
+
+/* Cut the window around (cx, cy), clamping at the frame edges, then
+ * log-scale, normalize to zero mean and unit variance and taper with
+ * the Hann window. */
+void MosseTracker::preprocess(const luma_image *frame) {
+	const int ww = this->win_width;
+	const int wh = this->win_height;
+	const int n = ww * wh;
+	int x0 = lround(this->cx) - ww / 2;
+	int y0 = lround(this->cy) - wh / 2;
+	double sum = 0, sumsq = 0;
+	for (int j = 0; j < wh; j++) {
+		int sy = clamp(y0 + j, 0, frame->height - 1);
+		const uint8_t *row = frame->data + sy * frame->stride;
+		double *p = this->patch + j * ww;
+		for (int i = 0; i < ww; i++) {
+			double v = this->log_table[row[clamp(x0 + i, 0, frame->width - 1)]];
+			p[i] = v;
+			sum += v;
+			sumsq += v * v;
+		}
+	}
+	double mean = sum / n;
+	double var = sumsq / n - mean * mean;
+	double inv = 1.0 / (sqrt(var > 0 ? var : 0) + 1e-5);
+	for (int k = 0; k < n; k++) {
+		this->patch[k] = (this->patch[k] - mean) * inv * this->window[k];
+	}
+}
+
+/* A = G F*, B = F F*, blended into the running filter at rate. */
+void MosseTracker::train(double rate) {
+	fftw_execute_dft_r2c(this->forward, this->patch, this->spec);
+	for (int k = 0; k < this->spec_size; k++) {
+		double fr = this->spec[k][0], fi = this->spec[k][1];
+		double gr = this->g[k][0], gi = this->g[k][1];
+		this->a[k][0] = rate * (gr * fr + gi * fi) + (1 - rate) * this->a[k][0];
+		this->a[k][1] = rate * (gi * fr - gr * fi) + (1 - rate) * this->a[k][1];
+		this->b[k] = rate * (fr * fr + fi * fi) + (1 - rate) * this->b[k];
+	}
+}
+
+/* Correlate the filter with the window at the last position, move to
+ * the response peak and update the filter there. Returns 1 if the peak
+ * is distinct enough to trust. */
+int MosseTracker::track(const luma_image *frame) {
+	const int ww = this->win_width;
+	const int wh = this->win_height;
+	const int n = ww * wh;
+	int peak = 0;
+	if (!this->active) return 0;
+	this->preprocess(frame);
+	fftw_execute_dft_r2c(this->forward, this->patch, this->spec);
+	for (int k = 0; k < this->spec_size; k++) {
+		double d = 1.0 / (this->b[k] + MOSSE_REGULARIZATION);
+		double hr = this->a[k][0] * d, hi = this->a[k][1] * d;
+		double fr = this->spec[k][0], fi = this->spec[k][1];
+		this->prod[k][0] = fr * hr - fi * hi;
+		this->prod[k][1] = fr * hi + fi * hr;
+	}
+	fftw_execute_dft_c2r(this->inverse, this->prod, this->response);
+	for (int k = 1; k < n; k++) {
+		if (this->response[k] > this->response[peak]) peak = k;
+	}
+	int px = peak % ww;
+	int py = peak / ww;
+	/* Peak to sidelobe ratio over everything outside an 11x11 square
+	 * around the peak. */
+	double sum = 0, sumsq = 0;
+	int count = 0;
+	for (int j = 0; j < wh; j++) {
+		int dy = abs(j - py);
+		if (wh - dy < dy) dy = wh - dy;
+		for (int i = 0; i < ww; i++) {
+			int dx = abs(i - px);
+			if (ww - dx < dx) dx = ww - dx;
+			if (dx <= 5 && dy <= 5) continue;
+			double v = this->response[i + j * ww];
+			sum += v;
+			sumsq += v * v;
+			count++;
+		}
+	}
+	double mean = count ? sum / count : 0;
+	double var = count ? sumsq / count - mean * mean : 0;
+	this->psr = (this->response[peak] - mean) / (sqrt(var > 0 ? var : 0) + 1e-9);
+	if (this->psr < MOSSE_PSR_THRESHOLD) return 0;
+	this->cx = fmin(fmax(this->cx + px - ww / 2, 0), frame->width - 1);
+	this->cy = fmin(fmax(this->cy + py - wh / 2, 0), frame->height - 1);
+	this->preprocess(frame);
+	this->train(MOSSE_LEARNING_RATE);
+	return 1;
+}
@@ -0,0 +1,51 @@
+#if !defined (_MOSSE_H)
+#define _MOSSE_H (1)
+
+#include <fftw3.h>
+
+#include "luma_pyramid.h"
+
+#define MOSSE_MIN_SIZE 16
+#define MOSSE_MAX_SIZE 128
+#define MOSSE_SIGMA 2.0
+#define MOSSE_LEARNING_RATE 0.125
+#define MOSSE_PSR_THRESHOLD 7.0
+#define MOSSE_REGULARIZATION 0.01
+
+/* Minimum output sum of squared error correlation filter (Bolme et al.
+ * 2010). The filter lives in the frequency domain; each frame costs one
+ * forward and one inverse r2c/c2r FFT to locate the target and one
+ * more forward FFT to update the filter, so the cost per frame is fixed
+ * by the window size. */
+class MosseTracker {
+public:
+	MosseTracker();
+	int init(const luma_image *frame, int x, int y, int w, int h);
+	void free();
+	int track(const luma_image *frame);
+	double cx;        // target centre, frame pixels
+	double cy;
+	int box_width;
+	int box_height;
+	double psr;       // peak to sidelobe ratio of the last response
+	int active;
+private:
+	void preprocess(const luma_image *frame);
+	void train(double rate);
+	int win_width;
+	int win_height;
+	int spec_size;
+	double log_table[256];
+	double *patch;
+	double *window;
+	double *response;
+	double *b;
+	fftw_complex *spec;
+	fftw_complex *prod;
+	fftw_complex *g;
+	fftw_complex *a;
+	fftw_plan forward;
+	fftw_plan inverse;
+};
+
+#endif
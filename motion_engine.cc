@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion_engine.h"
+
+MotionEngine::MotionEngine() {
+	nslots = 0;
+	nchanged = 0;
+	score = on_threshold = off_threshold = hold = hold_until = NULL;
+	active = state = NULL;
+	delta = NULL;
+	changed = NULL;
+}
+
+static void *alloc_slots(int nslots, size_t size) {
+	void *p = aligned_alloc(32, ((nslots * size + 31) / 32) * 32);
+	if (!p) {
+		fprintf(stderr, "Could not allocate motion state\n");
+		exit(1);
+	}
+	memset(p, 0, nslots * size);
+	return p;
+}
+
+int MotionEngine::init(int nslots) {
+	this->nslots = nslots;
+	this->score = (double *)alloc_slots(nslots, sizeof(double));
+	this->on_threshold = (double *)alloc_slots(nslots, sizeof(double));
+	this->off_threshold = (double *)alloc_slots(nslots, sizeof(double));
+	this->hold = (double *)alloc_slots(nslots, sizeof(double));
+	this->hold_until = (double *)alloc_slots(nslots, sizeof(double));
+	this->active = (uint8_t *)alloc_slots(nslots, sizeof(uint8_t));
+	this->state = (uint8_t *)alloc_slots(nslots, sizeof(uint8_t));
+	this->delta = (int8_t *)alloc_slots(nslots, sizeof(int8_t));
+	this->changed = (int *)alloc_slots(nslots, sizeof(int));
+	for (int i = 0; i < nslots; i++) {
+		this->hold[i] = MOTION_HOLD_SECONDS;
+	}
+	this->nchanged = 0;
+	return 0;
+}
+
+void MotionEngine::free() {
+	::free(this->score);
+	::free(this->on_threshold);
+	::free(this->off_threshold);
+	::free(this->hold);
+	::free(this->hold_until);
+	::free(this->active);
+	::free(this->state);
+	::free(this->delta);
+	::free(this->changed);
+	this->score = this->on_threshold = this->off_threshold = NULL;
+	this->hold = this->hold_until = NULL;
+	this->active = this->state = NULL;
+	this->delta = NULL;
+	this->changed = NULL;
+	this->nslots = 0;
+}
+
+void MotionEngine::set_thresholds(double on, double off) {
+	for (int i = 0; i < this->nslots; i++) {
+		this->on_threshold[i] = on;
+		this->off_threshold[i] = off;
+	}
+}
+
+void MotionEngine::reset(int slot) {
+	this->score[slot] = 0;
+	this->hold_until[slot] = 0;
+	this->state[slot] = 0;
+	this->delta[slot] = 0;
+}
+
+int MotionEngine::update(double now) {
+	const int n = this->nslots;
+	const double *__restrict score = this->score;
+	double *__restrict hold_until = this->hold_until;
+	const double *__restrict on = this->on_threshold;
+	const double *__restrict off = this->off_threshold;
+	const double *__restrict hold = this->hold;
+	const uint8_t *__restrict active = this->active;
+	uint8_t *__restrict state = this->state;
+	int8_t *__restrict delta = this->delta;
+	for (int i = 0; i < n; i++) {
+		uint8_t moving = (score[i] > on[i]) | (state[i] & (score[i] > off[i]));
+		uint8_t held = state[i] & (now < hold_until[i]);
+		uint8_t next = active[i] & (moving | held);
+		hold_until[i] = moving ? now + hold[i] : hold_until[i];
+		delta[i] = next - state[i];
+		state[i] = next;
+	}
+	this->nchanged = 0;
+	for (int i = 0; i < n; i++) {
+		this->changed[this->nchanged] = i;
+		this->nchanged += delta[i] != 0;
+	}
+	return this->nchanged;
+}
@@ -0,0 +1,36 @@
+#if !defined (_MOTION_ENGINE_H)
+#define _MOTION_ENGINE_H (1)
+
+#include <stdint.h>
+
+#define MOTION_HOLD_SECONDS 0.2
+#define MOTION_OFF_RATIO 0.5
+#define MOTION_LEVEL_EXPONENT 0.75  // scores on level n are scaled by 2^(0.75 n)
+
+/* Motion on/off state of every sound shape slot, one array per field.
+ * A slot turns on when its score rises above on_threshold and stays on
+ * while the score is above off_threshold or until hold seconds after
+ * it last was. update() advances every slot in one pass against a
+ * single timestamp and lists the slots whose state changed. */
+class MotionEngine {
+public:
+	MotionEngine();
+	int init(int nslots);
+	void free();
+	void set_thresholds(double on, double off);
+	void reset(int slot);
+	int update(double now);
+	int nslots;
+	double *score;
+	double *on_threshold;
+	double *off_threshold;
+	double *hold;
+	double *hold_until;
+	uint8_t *active;
+	uint8_t *state;
+	int8_t *delta;     // +1 turned on, -1 turned off this frame
+	int *changed;      // slots with a nonzero delta
+	int nchanged;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "muxer.h"
+
+Muxer::Muxer() {
+	oc = NULL;
+	nstreams = 0;
+	running = 0;
+	full_waits.store(0);
+	for (int s = 0; s < MUXER_MAX_STREAMS; s++) {
+		queues[s] = NULL;
+		heads[s] = NULL;
+		finished[s].store(0);
+		drained[s] = 0;
+	}
+}
+
+void Muxer::start(AVFormatContext *oc) {
+	this->free();
+	this->oc = oc;
+	this->nstreams = oc->nb_streams;
+	if (this->nstreams > MUXER_MAX_STREAMS) {
+		fprintf(stderr, "Too many output streams\n");
+		exit(1);
+	}
+	this->full_waits.store(0);
+	this->data_ready.init();
+	for (int s = 0; s < this->nstreams; s++) {
+		this->queues[s] = jack_ringbuffer_create(MUXER_QUEUE_PACKETS * sizeof(AVPacket *));
+		if (!this->queues[s]) {
+			fprintf(stderr, "Could not allocate muxer queue\n");
+			exit(1);
+		}
+		this->heads[s] = NULL;
+		this->finished[s].store(0);
+		this->drained[s] = 0;
+		this->space_ready[s].init();
+	}
+	if (pthread_create(&this->thread_id, NULL, Muxer::thread, this)) {
+		fprintf(stderr, "Could not start muxer thread\n");
+		exit(1);
+	}
+	pthread_setname_np(this->thread_id, "v4l2_wl_mux");
+	this->running = 1;
+}
+
+/* Waits for the file to be finished, then frees the queues. */
+void Muxer::free() {
+	if (!this->running) return;
+	pthread_join(this->thread_id, NULL);
+	this->running = 0;
+	this->data_ready.free();
+	for (int s = 0; s < this->nstreams; s++) {
+		jack_ringbuffer_free(this->queues[s]);
+		this->queues[s] = NULL;
+		this->space_ready[s].free();
+	}
+	if (this->full_waits.load()) {
+		printf("muxer: encoders waited %ld times on a full queue\n", this->full_waits.load());
+	}
+}
+
+/* Called on the encoder thread that owns pkt->stream_index. Takes
+ * over pkt's reference and leaves pkt blank. */
+void Muxer::push(AVPacket *pkt) {
+	int s = pkt->stream_index;
+	AVPacket *p = av_packet_alloc();
+	if (!p) {
+		fprintf(stderr, "Could not allocate packet\n");
+		exit(1);
+	}
+	av_packet_move_ref(p, pkt);
+	while (jack_ringbuffer_write_space(this->queues[s]) < sizeof(p)) {
+		this->full_waits.fetch_add(1, std::memory_order_relaxed);
+		this->space_ready[s].wait();
+	}
+	jack_ringbuffer_write(this->queues[s], (const char *)&p, sizeof(p));
+	this->data_ready.notify();
+}
+
+/* Called on the encoder thread once it has pushed its last packet. */
+void Muxer::finish(int stream) {
+	this->finished[stream].store(1, std::memory_order_release);
+	this->data_ready.notify();
+}
+
+/* Moves the next packet of stream into its head slot if there is one,
+ * and notes when a finished stream has run dry. */
+int Muxer::take(int s) {
+	if (this->heads[s]) return 1;
+	if (this->drained[s]) return 0;
+	/* Read finished first: a push that came before finish() is then
+	 * sure to be visible in the queue. */
+	int done = this->finished[s].load(std::memory_order_acquire);
+	if (jack_ringbuffer_read_space(this->queues[s]) >= sizeof(AVPacket *)) {
+		jack_ringbuffer_read(this->queues[s], (char *)&this->heads[s], sizeof(AVPacket *));
+		this->space_ready[s].notify();
+		return 1;
+	}
+	if (done) this->drained[s] = 1;
+	return 0;
+}
+
+/* The stream whose head should be written next, or -1 to wait. Heads
+ * go out in DTS order once every live stream has one. If a stream
+ * falls far behind, the other is written anyway so its encoder does
+ * not stall; av_interleaved_write_frame() still buffers and orders
+ * what it is given. */
+int Muxer::next() {
+	int best = -1, waiting = 0;
+	for (int s = 0; s < this->nstreams; s++) {
+		if (!this->take(s)) {
+			if (!this->drained[s]) waiting = 1;
+			continue;
+		}
+		if (best < 0) {
+			best = s;
+			continue;
+		}
+		AVPacket *a = this->heads[s];
+		AVPacket *b = this->heads[best];
+		int64_t ta = a->dts != AV_NOPTS_VALUE ? a->dts : a->pts;
+		int64_t tb = b->dts != AV_NOPTS_VALUE ? b->dts : b->pts;
+		if (av_compare_ts(ta, this->oc->streams[s]->time_base,
+						  tb, this->oc->streams[best]->time_base) < 0) {
+			best = s;
+		}
+	}
+	if (best >= 0 && waiting &&
+			jack_ringbuffer_write_space(this->queues[best]) > MUXER_QUEUE_PACKETS / 2 * sizeof(AVPacket *)) {
+		return -1;
+	}
+	return best;
+}
+
+void Muxer::write(int s) {
+	char err[AV_ERROR_MAX_STRING_SIZE];
+	AVPacket *p = this->heads[s];
+	this->heads[s] = NULL;
+	int ret = av_interleaved_write_frame(this->oc, p);
+	av_packet_free(&p);
+	if (ret < 0) {
+		av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret);
+		fprintf(stderr, "Error while writing frame: %s\n", err);
+		exit(1);
+	}
+}
+
+void *Muxer::thread(void *arg) {
+	Muxer *m = (Muxer *)arg;
+	int s, all_drained;
+	for (;;) {
+		while ((s = m->next()) >= 0) {
+			m->write(s);
+		}
+		all_drained = 1;
+		for (s = 0; s < m->nstreams; s++) {
+			if (!m->drained[s]) all_drained = 0;
+		}
+		if (all_drained) break;
+		m->data_ready.wait();
+	}
+	av_write_trailer(m->oc);
+	if (!(m->oc->oformat->flags & AVFMT_NOFILE)) {
+		avio_closep(&m->oc->pb);
+	}
+	return NULL;
+}
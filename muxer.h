@@ -0,0 +1,54 @@
+#if !defined (_MUXER_H)
+#define _MUXER_H (1)
+
+#include <pthread.h>
+#include <atomic>
+#include <jack/ringbuffer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "notifier.h"
+
+#define MUXER_MAX_STREAMS 2
+#define MUXER_QUEUE_PACKETS 1024   // per stream, several seconds of either
+
+/* The only thread that touches the output file. Each encoder thread
+ * owns the queue of its stream: push() moves a packet, already in the
+ * stream time base, into a heap packet and hands over the pointer, so
+ * an encoder never waits on the disk or on the other encoder unless
+ * its queue is full. The muxer thread writes the queue heads in DTS
+ * order, and once every stream is finished and drained writes the
+ * trailer and closes the file. */
+class Muxer {
+public:
+	Muxer();
+	void start(AVFormatContext *oc);
+	void push(AVPacket *pkt);
+	void finish(int stream);
+	void free();
+	std::atomic<long> full_waits;
+private:
+	static void *thread(void *arg);
+	int take(int stream);
+	int next();
+	void write(int stream);
+	AVFormatContext *oc;
+	int nstreams;
+	jack_ringbuffer_t *queues[MUXER_MAX_STREAMS];
+	AVPacket *heads[MUXER_MAX_STREAMS];
+	std::atomic<int> finished[MUXER_MAX_STREAMS];
+	int drained[MUXER_MAX_STREAMS];
+	pthread_t thread_id;
+	int running;
+	Notifier data_ready;
+	Notifier space_ready[MUXER_MAX_STREAMS];
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "muxing.h"
 #include "v4l2_wayland.h"
 #include "dingle_dots.h"
+#include "yuv.h"
 
 extern OutputStream video_st;
 static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt)
@@ -23,27 +24,24 @@ static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt)
 		   pts, pts_str, dts, dts_str, dur, dur_str, pkt->stream_index);
 }
 
-static int write_frame(AVFormatContext *fmt_ctx,
-					   const AVRational *time_base, AVStream *st, AVPacket *pkt) {
-	pthread_mutex_lock(&av_thread_lock);
-	int ret;
+static void write_frame(DingleDots *dd, AVFormatContext *fmt_ctx,
+						const AVRational *time_base, AVStream *st, AVPacket *pkt) {
 	/* rescale output packet timestamp values from codec to stream timebase */
 	av_packet_rescale_ts(pkt, *time_base, st->time_base);
 	pkt->stream_index = st->index;
-	/* Write the compressed frame to the media file. */
 	if (0) log_packet(fmt_ctx, pkt);
-	ret = av_interleaved_write_frame(fmt_ctx, pkt);
-	pthread_mutex_unlock(&av_thread_lock);
-	return ret;
+	/* The muxer thread writes it to the media file. */
+	dd->muxer.push(pkt);
 }
 
 /* Add an output stream. */
 static void add_stream(OutputStream *ost, AVFormatContext *oc,
 					   AVCodec **codec, enum AVCodecID codec_id, int width,
-					   int height, int video_bitrate) {
+					   int height, int video_bitrate, int nchannels) {
 	AVCodecContext *c;
+	uint64_t layout;
 	int i;
-	*codec = avcodec_find_encoder(codec_id);
+	if (!*codec) *codec = avcodec_find_encoder(codec_id);
 	if (!(*codec)) {
 		fprintf(stderr, "Could not find encoder for '%s'\n",
 				avcodec_get_name(codec_id));
@@ -75,13 +73,18 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 						c->sample_rate = 48000;
 				}
 			}
-			c->channels = av_get_channel_layout_nb_channels(c->channel_layout);
-			c->channel_layout = AV_CH_LAYOUT_STEREO;
+			/* Keep every JACK output if the encoder can, otherwise
+			 * fall back to stereo and let swr mix down. */
+			layout = audio_channel_layout(nchannels);
+			c->channel_layout = layout;
 			if ((*codec)->channel_layouts) {
 				c->channel_layout = (*codec)->channel_layouts[0];
 				for (i = 0; (*codec)->channel_layouts[i]; i++) {
-					if ((*codec)->channel_layouts[i] == AV_CH_LAYOUT_STEREO)
+					if ((*codec)->channel_layouts[i] == AV_CH_LAYOUT_STEREO &&
+							c->channel_layout != layout)
 						c->channel_layout = AV_CH_LAYOUT_STEREO;
+					if ((*codec)->channel_layouts[i] == layout)
+						c->channel_layout = layout;
 				}
 			}
 			c->channels = av_get_channel_layout_nb_channels(c->channel_layout);
@@ -89,14 +92,22 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 			break;
 		case AVMEDIA_TYPE_VIDEO:
 			printf("case VIDEO\n");
-			c->codec_id = codec_id;
+			c->codec_id = (*codec)->id;
 			c->bit_rate = video_bitrate;
 			c->width    = width;
 			c->height   = height;
 			ost->st->time_base = (AVRational){ 1, STREAM_FRAME_RATE };
 			c->time_base       = ost->st->time_base;
-			c->gop_size      = 12;
+			c->gop_size      = ENCODER_DEFAULT_GOP;
 			c->pix_fmt       = AV_PIX_FMT_YUV420P;
+			/* Anything else goes through sws_scale(). */
+			if ((*codec)->pix_fmts) {
+				c->pix_fmt = (*codec)->pix_fmts[0];
+				for (i = 0; (*codec)->pix_fmts[i] != AV_PIX_FMT_NONE; i++) {
+					if ((*codec)->pix_fmts[i] == AV_PIX_FMT_YUV420P)
+						c->pix_fmt = AV_PIX_FMT_YUV420P;
+				}
+			}
 			if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
 				c->max_b_frames = 2;
 			}
@@ -114,6 +125,18 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 /**************************************************************/
 /* audio output */
 
+/* A layout with nchannels channels. libavutil has no default for some
+ * counts, 9 to 15 among them, and those take the first nchannels
+ * channel positions in order, so swr and the muxer always see a layout
+ * that agrees with the channel count. */
+uint64_t audio_channel_layout(int nchannels) {
+	uint64_t layout = av_get_default_channel_layout(nchannels);
+	if (!layout && nchannels > 0 && nchannels < 64) {
+		layout = (1ULL << nchannels) - 1;
+	}
+	return layout;
+}
+
 static AVFrame *alloc_audio_frame(enum AVSampleFormat sample_fmt,
 								  uint64_t channel_layout, int sample_rate, int nb_samples) {
 	AVFrame *frame = av_frame_alloc();
@@ -160,7 +183,8 @@ static void open_audio(AVCodec *codec, OutputStream *ost,
 	ost->samples_count = 0;
 	ost->frame     = alloc_audio_frame(c->sample_fmt, c->channel_layout,
 									   c->sample_rate, nb_samples);
-	ost->tmp_frame = alloc_audio_frame(AV_SAMPLE_FMT_FLT, c->channel_layout,
+	ost->tmp_frame = alloc_audio_frame(AV_SAMPLE_FMT_FLT,
+									   audio_channel_layout(ost->in_channels),
 									   c->sample_rate, nb_samples);
 	ret = avcodec_parameters_from_context(ost->st->codecpar, c);
 	if (ret < 0) {
@@ -172,9 +196,12 @@ static void open_audio(AVCodec *codec, OutputStream *ost,
 		fprintf(stderr, "Could not allocate resampler context\n");
 		exit(1);
 	}
-	av_opt_set_int(ost->swr_ctx, "in_channel_count", c->channels, 0);
+	av_opt_set_int(ost->swr_ctx, "in_channel_layout",
+				   audio_channel_layout(ost->in_channels), 0);
+	av_opt_set_int(ost->swr_ctx, "in_channel_count", ost->in_channels, 0);
 	av_opt_set_int(ost->swr_ctx, "in_sample_rate", c->sample_rate, 0);
 	av_opt_set_sample_fmt(ost->swr_ctx, "in_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
+	av_opt_set_int(ost->swr_ctx, "out_channel_layout", c->channel_layout, 0);
 	av_opt_set_int(ost->swr_ctx, "out_channel_count", c->channels, 0);
 	av_opt_set_int(ost->swr_ctx, "out_sample_rate", c->sample_rate, 0);
 	av_opt_set_sample_fmt(ost->swr_ctx, "out_sample_fmt", c->sample_fmt, 0);
@@ -184,28 +211,70 @@ static void open_audio(AVCodec *codec, OutputStream *ost,
 	}
 }
 
+/* Interleave one JACK period straight into the ring through its write
+ * vector. A period that does not fit is dropped whole, so the channels
+ * never slip against each other. Never blocks; returns -1 on overrun. */
+int audio_ring_write_period(jack_ringbuffer_t *rb, jack_default_audio_sample_t **chans,
+							int nchans, jack_nframes_t nframes) {
+	jack_ringbuffer_data_t vec[2];
+	size_t need = sizeof(float) * nframes * nchans;
+	jack_ringbuffer_get_write_vector(rb, vec);
+	if (vec[0].len + vec[1].len < need) return -1;
+	float *dst = (float *)vec[0].buf;
+	size_t left = vec[0].len / sizeof(float);
+	for (jack_nframes_t i = 0; i < nframes; i++) {
+		if (left >= (size_t)nchans) {
+			for (int chn = 0; chn < nchans; chn++) {
+				dst[chn] = chans[chn][i];
+			}
+			dst += nchans;
+			left -= nchans;
+			continue;
+		}
+		/* This frame straddles the end of the first segment. */
+		for (int chn = 0; chn < nchans; chn++) {
+			if (!left) {
+				dst = (float *)vec[1].buf;
+				left = vec[1].len / sizeof(float);
+			}
+			*dst++ = chans[chn][i];
+			left--;
+		}
+	}
+	jack_ringbuffer_write_advance(rb, need);
+	return 0;
+}
+
+/* Copy nsamples interleaved samples out of the ring through its read
+ * vector, or nothing if fewer are available. */
+int audio_ring_read(jack_ringbuffer_t *rb, float *dst, size_t nsamples) {
+	jack_ringbuffer_data_t vec[2];
+	size_t size = sizeof(float) * nsamples;
+	jack_ringbuffer_get_read_vector(rb, vec);
+	if (vec[0].len + vec[1].len < size) return -1;
+	size_t first = vec[0].len < size ? vec[0].len : size;
+	memcpy(dst, vec[0].buf, first);
+	if (first < size) {
+		memcpy((char *)dst + first, vec[1].buf, size - first);
+	}
+	jack_ringbuffer_read_advance(rb, size);
+	return 0;
+}
+
 int get_audio_frame(DingleDots *dd, OutputStream *ost, AVFrame **ret_frame) {
 	AVFrame *frame = ost->tmp_frame;
-	int j, i;
-	float *q = (float*)frame->data[0];
 	*ret_frame = frame;
 	if (dd->recording_stopped) {
 		printf("audio done\n");
 		ret_frame = NULL;
 		return 1;
 	}
-	uint size = sizeof(float)*frame->nb_samples*ost->enc->channels;
-	if (jack_ringbuffer_read_space(audio_ring_buf) < size) {
+	if (audio_ring_read(audio_ring_buf, (float *)frame->data[0],
+						frame->nb_samples * ost->in_channels)) {
 		return -1;
-	} else {
-		frame->pts = ost->next_pts;
-		ost->next_pts += frame->nb_samples;
-		for (i = 0; i < frame->nb_samples; i++) {
-			for (j = 0; j < ost->enc->channels; j++) {
-				jack_ringbuffer_read(audio_ring_buf, (char *)q++, sizeof(float));
-			}
-		}
 	}
+	frame->pts = ost->next_pts;
+	ost->next_pts += frame->nb_samples;
 	return 0;
 }
 
@@ -253,12 +322,7 @@ int write_audio_frame(DingleDots *dd, AVFormatContext *oc,
 			exit(1);
 		}
 		while(avcodec_receive_packet(c, &pkt) >= 0) {
-			ret = write_frame(oc, &c->time_base, ost->st, &pkt);
-			if (ret < 0) {
-				av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret);
-				fprintf(stderr, "Error while writing audio frame: %s\n", err);
-				exit(1);
-			}
+			write_frame(dd, oc, &c->time_base, ost->st, &pkt);
 		}
 		return 0;
 	}
@@ -278,35 +342,26 @@ static void open_video(int width, int height, AVCodec *codec, OutputStream *ost,
 
 	/* open the codec */
 	ret = avcodec_open2(c, codec, &opt);
-	av_dict_free(&opt);
 	if (ret < 0) {
 		av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret);
 		fprintf(stderr, "Could not open video codec: %s\n", err);
 		exit(1);
 	}
-
-	/* allocate and init a re-usable frame */
-	ost->frame = av_frame_alloc();
-	if (!ost->frame) {
-		fprintf(stderr, "Could not allocate video frame\n");
-		exit(1);
+	/* Whatever is left was not recognised by the encoder. */
+	AVDictionaryEntry *e = NULL;
+	while ((e = av_dict_get(opt, "", e, AV_DICT_IGNORE_SUFFIX))) {
+		fprintf(stderr, "%s ignored option %s=%s\n", codec->name, e->key, e->value);
 	}
-	ost->frame->format = AV_PIX_FMT_BGRA;
-	ost->frame->width = width;
-	ost->frame->height = height;
-	ost->out_frame.size = 4 * width * height;
-	ost->out_frame.data = (uint32_t *)calloc(1, ost->out_frame.size);
-	av_image_fill_arrays(ost->frame->data, ost->frame->linesize,
-						 (const unsigned char *)ost->out_frame.data, (AVPixelFormat)ost->frame->format,
-						 ost->frame->width, ost->frame->height, 32);
-	/* If the output format is not YUV420P, then a temporary YUV420P
-	 * picture is needed too. It is then converted to the required
-	 * output format. */
+	av_dict_free(&opt);
+
+	/* The compositor's BGRA frames arrive from the frame pool; this is
+	 * the picture the encoder is given, in its own pixel format. */
+	ost->frame = NULL;
 	ost->tmp_frame = NULL;
 	ost->tmp_frame = av_frame_alloc();
 	ost->tmp_frame->width = width;
 	ost->tmp_frame->height = height;
-	ost->tmp_frame->format = AV_PIX_FMT_YUV420P;
+	ost->tmp_frame->format = c->pix_fmt;
 	av_image_alloc(ost->tmp_frame->data, ost->tmp_frame->linesize,
 				   ost->tmp_frame->width, ost->tmp_frame->height, (AVPixelFormat)ost->tmp_frame->format, 1);
 	//ost->tmp_frame = alloc_picture(AV_PIX_FMT_YUV420P, c->width, c->height);
@@ -325,40 +380,45 @@ static void open_video(int width, int height, AVCodec *codec, OutputStream *ost,
 
 int get_video_frame(DingleDots *dd, OutputStream *ost, AVFrame **ret_frame) {
 	AVCodecContext *c = ost->enc;
+	recorded_frame rf;
 	*ret_frame = NULL;
-	int size = ost->out_frame.size + sizeof(struct timespec);
-	int space = jack_ringbuffer_read_space(video_ring_buf);
-	if (space < size) {
-		if (dd->recording_stopped) {
+	/* Nothing is queued after recording stops, so once it has stopped
+	 * an empty queue means every frame has been taken. */
+	int stopped = dd->recording_stopped;
+	if (!frame_queue_pop(video_ring_buf, &rf)) {
+		if (stopped) {
 			return 1;
 		} else {
 			return -1;
 		}
 	} else {
-		jack_ringbuffer_read(video_ring_buf, (char *)ost->out_frame.data,
-							 ost->out_frame.size);
-		jack_ringbuffer_read(video_ring_buf, (char *)&ost->out_frame.ts,
-							 sizeof(struct timespec));
 		double diff;
 		struct timespec *now;
-		now = &ost->out_frame.ts;
+		now = &rf.ts;
 		diff = now->tv_sec + 1e-9*now->tv_nsec - (ost->first_time.tv_sec +
 												  1e-9*ost->first_time.tv_nsec);
 		ost->next_pts = (int) c->time_base.den * diff / c->time_base.num;
-		if (!ost->sws_ctx) {
-			ost->sws_ctx = sws_getContext(c->width, c->height,
-										  (AVPixelFormat)ost->frame->format, c->width, c->height, c->pix_fmt,
-										  SCALE_FLAGS, NULL, NULL, NULL);
+		if (c->pix_fmt == AV_PIX_FMT_YUV420P) {
+			bgra_to_i420(&dd->thread_pool, rf.frame->data[0], rf.frame->linesize[0],
+						 ost->tmp_frame->data, ost->tmp_frame->linesize, c->width, c->height);
+		} else {
 			if (!ost->sws_ctx) {
-				fprintf(stderr,
-						"Could not initialize the conversion context\n");
-				exit(1);
+				ost->sws_ctx = sws_getContext(c->width, c->height,
+											  AV_PIX_FMT_BGRA, c->width, c->height, c->pix_fmt,
+											  SCALE_FLAGS, NULL, NULL, NULL);
+				if (!ost->sws_ctx) {
+					fprintf(stderr,
+							"Could not initialize the conversion context\n");
+					exit(1);
+				}
 			}
+			sws_scale(ost->sws_ctx, (const uint8_t * const *)rf.frame->data,
+					  rf.frame->linesize, 0, c->height, ost->tmp_frame->data,
+					  ost->tmp_frame->linesize);
 		}
-		sws_scale(ost->sws_ctx, (const uint8_t * const *)ost->frame->data,
-				  ost->frame->linesize, 0, c->height, ost->tmp_frame->data,
-				  ost->tmp_frame->linesize);
-		ost->tmp_frame->pts = ost->frame->pts = ost->next_pts;
+		/* Back to the pool for the compositor. */
+		av_frame_free(&rf.frame);
+		ost->tmp_frame->pts = ost->next_pts;
 		*ret_frame = ost->tmp_frame;
 		return 0;
 	}
@@ -391,12 +451,7 @@ int write_video_frame(DingleDots *dd, AVFormatContext *oc, OutputStream *ost)
 			exit(1);
 		}
 		while (avcodec_receive_packet(c, &pkt) >= 0) {
-			ret = write_frame(oc, &c->time_base, ost->st, &pkt);
-			if (ret < 0) {
-				av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret);
-				fprintf(stderr, "Error while writing video frame: %s\n", err);
-				exit(1);
-			}
+			write_frame(dd, oc, &c->time_base, ost->st, &pkt);
 		}
 		return 1;
 	} else {
@@ -409,12 +464,7 @@ int write_video_frame(DingleDots *dd, AVFormatContext *oc, OutputStream *ost)
 			exit(1);
 		}
 		while (avcodec_receive_packet(c, &pkt) >= 0) {
-			ret = write_frame(oc, &c->time_base, ost->st, &pkt);
-			if (ret < 0) {
-				av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret);
-				fprintf(stderr, "Error while writing video frame: %s\n", err);
-				exit(1);
-			}
+			write_frame(dd, oc, &c->time_base, ost->st, &pkt);
 		}
 		return 0;
 	}
@@ -432,13 +482,178 @@ void close_stream(OutputStream *ost)
 /**************************************************************/
 /* media file output */
 
+void encoder_settings_default(encoder_settings *es) {
+	es->codec = NULL;
+	es->preset = NULL;
+	es->threads = 0;
+	es->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	es->gop_size = ENCODER_DEFAULT_GOP;
+	es->rate_control = ENCODER_RC_VBR;
+	es->quality = ENCODER_DEFAULT_CRF;
+	es->options = NULL;
+}
+
+/* vbr, cbr, or crf[:quality] */
+int encoder_parse_rate_control(encoder_settings *es, const char *arg) {
+	if (strcmp(arg, "vbr") == 0) {
+		es->rate_control = ENCODER_RC_VBR;
+	} else if (strcmp(arg, "cbr") == 0) {
+		es->rate_control = ENCODER_RC_CBR;
+	} else if (strcmp(arg, "crf") == 0) {
+		es->rate_control = ENCODER_RC_CRF;
+	} else if (sscanf(arg, "crf:%lf", &es->quality) == 1 && es->quality >= 0) {
+		es->rate_control = ENCODER_RC_CRF;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* slice, frame, or auto for either */
+int encoder_parse_thread_type(encoder_settings *es, const char *arg) {
+	if (strcmp(arg, "slice") == 0) {
+		es->thread_type = FF_THREAD_SLICE;
+	} else if (strcmp(arg, "frame") == 0) {
+		es->thread_type = FF_THREAD_FRAME;
+	} else if (strcmp(arg, "auto") == 0) {
+		es->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static int has_option(AVCodecContext *c, const char *name) {
+	return c->priv_data && av_opt_find(c->priv_data, name, NULL, 0, 0);
+}
+
+/* The libvpx deadline for a preset named either way, or NULL. */
+static const char *preset_to_deadline(const char *preset) {
+	static const char *const names[][2] = {
+		{ "realtime", "realtime" }, { "good", "good" }, { "best", "best" },
+		{ "ultrafast", "realtime" }, { "superfast", "realtime" },
+		{ "veryfast", "realtime" }, { "faster", "realtime" },
+		{ "fast", "good" }, { "medium", "good" }, { "slow", "good" },
+		{ "slower", "best" }, { "veryslow", "best" }, { "placebo", "best" },
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(preset, names[i][0]) == 0) return names[i][1];
+	}
+	return NULL;
+}
+
+/* Applies the settings to a video encoder that is not open yet, with
+ * the encoder's private options going into opt. The preset is libx264
+ * style "preset" where there is one and libvpx "deadline" otherwise,
+ * with libx264 names mapped to the nearest deadline. libvpx without a
+ * preset, or with one it cannot take, keeps the realtime settings this
+ * always used.
+ * es->options go in last so they override everything here. */
+static void configure_video(AVCodecContext *c, const encoder_settings *es,
+							AVDictionary **opt) {
+	char buf[32];
+	const char *deadline;
+	c->thread_count = es->threads;
+	c->thread_type = es->thread_type;
+	c->gop_size = es->gop_size;
+	if (es->preset && has_option(c, "preset")) {
+		av_dict_set(opt, "preset", es->preset, 0);
+	} else if (has_option(c, "deadline")) {
+		deadline = es->preset ? preset_to_deadline(es->preset) : NULL;
+		if (es->preset && !deadline) {
+			fprintf(stderr, "%s has no preset %s, using realtime\n",
+					c->codec->name, es->preset);
+		}
+		if (deadline) {
+			av_dict_set(opt, "deadline", deadline, 0);
+		} else {
+			av_dict_set(opt, "deadline", "realtime", 0);
+			av_dict_set(opt, "cpu-used", "-8", 0);
+		}
+	} else if (es->preset) {
+		fprintf(stderr, "%s has no presets, ignoring %s\n",
+				c->codec->name, es->preset);
+	}
+	switch (es->rate_control) {
+		case ENCODER_RC_CBR:
+			c->rc_min_rate = c->bit_rate;
+			c->rc_max_rate = c->bit_rate;
+			c->rc_buffer_size = c->bit_rate;
+			break;
+		case ENCODER_RC_CRF:
+			c->bit_rate = 0;
+			if (has_option(c, "crf")) {
+				snprintf(buf, sizeof(buf), "%g", es->quality);
+				av_dict_set(opt, "crf", buf, 0);
+			} else {
+				c->flags |= AV_CODEC_FLAG_QSCALE;
+				c->global_quality = FF_QP2LAMBDA * es->quality;
+			}
+			break;
+		default:
+			break;
+	}
+	av_dict_copy(opt, es->options, 0);
+}
+
+/* One line with what the encoder actually ended up using, read back
+ * from the open encoder rather than from what was asked for. */
+static void print_video_config(AVCodecContext *c, const encoder_settings *es) {
+	const char *threading = "none";
+	uint8_t *preset = NULL;
+	int64_t deadline;
+	double crf;
+	if (c->active_thread_type & FF_THREAD_FRAME) threading = "frame";
+	else if (c->active_thread_type & FF_THREAD_SLICE) threading = "slice";
+	printf("encoder: %s %dx%d %s, gop %d, ",
+		   c->codec->name, c->width, c->height,
+		   av_get_pix_fmt_name(c->pix_fmt), c->gop_size);
+	if (has_option(c, "preset") &&
+			av_opt_get(c->priv_data, "preset", 0, &preset) >= 0 && preset) {
+		printf("preset %s, ", preset);
+		av_free(preset);
+	} else if (has_option(c, "deadline") &&
+			   av_opt_get_int(c->priv_data, "deadline", 0, &deadline) >= 0) {
+		/* VPX_DL_REALTIME, VPX_DL_GOOD_QUALITY and VPX_DL_BEST_QUALITY */
+		if (deadline == 1) printf("deadline realtime, ");
+		else if (deadline == 1000000) printf("deadline good, ");
+		else if (deadline == 0) printf("deadline best, ");
+		else printf("deadline %lld us, ", (long long)deadline);
+	}
+	if (es->rate_control == ENCODER_RC_CRF) {
+		if (has_option(c, "crf") &&
+				av_opt_get_double(c->priv_data, "crf", 0, &crf) >= 0) {
+			printf("crf %g, ", crf);
+		} else {
+			printf("qscale %g, ", (double)c->global_quality / FF_QP2LAMBDA);
+		}
+	} else {
+		printf("%s %lld b/s, ", es->rate_control == ENCODER_RC_CBR ?
+			   "cbr" : "vbr", (long long)c->bit_rate);
+	}
+	/* Encoders such as libx264 run their own threads, which lavc
+	 * neither starts nor reports. */
+	if (c->codec->capabilities & AV_CODEC_CAP_AUTO_THREADS) {
+		if (c->thread_count) {
+			printf("%d threads of the encoder's own\n", c->thread_count);
+		} else {
+			printf("encoder chosen threads\n");
+		}
+	} else if (c->active_thread_type) {
+		printf("%d threads (%s threading)\n", c->thread_count, threading);
+	} else {
+		printf("single threaded\n");
+	}
+}
+
 int init_output(DingleDots *dd) {
 	const char *filename;
 	AVOutputFormat *fmt;
-	AVCodec *audio_codec, *video_codec;
+	AVCodec *audio_codec = NULL, *video_codec = NULL;
 	int ret;
 	char err[AV_ERROR_MAX_STRING_SIZE];
 	AVDictionary *opt = NULL;
+	encoder_settings *es = &dd->encoder;
 	av_register_all();
 	filename = dd->video_file_name;
 	avformat_alloc_output_context2(&dd->video_output_context, NULL, NULL, filename);
@@ -449,17 +664,31 @@ int init_output(DingleDots *dd) {
 	if (!dd->video_output_context)
 		return 1;
 	fmt = dd->video_output_context->oformat;
+	if (es->codec) {
+		video_codec = avcodec_find_encoder_by_name(es->codec);
+		if (!video_codec || video_codec->type != AVMEDIA_TYPE_VIDEO) {
+			fprintf(stderr, "Unknown video encoder %s\n", es->codec);
+			return 1;
+		}
+		if (avformat_query_codec(fmt, video_codec->id, FF_COMPLIANCE_NORMAL) != 1) {
+			fprintf(stderr, "%s cannot hold %s, choose another file extension\n",
+					fmt->name, video_codec->name);
+			return 1;
+		}
+	}
 	add_stream(&dd->video_thread_info.stream, dd->video_output_context,
 			   &video_codec, fmt->video_codec, dd->drawing_rect.width,
-			   dd->drawing_rect.height, dd->video_bitrate);
+			   dd->drawing_rect.height, dd->video_bitrate, 0);
 	if (fmt->audio_codec != AV_CODEC_ID_NONE) {
+		dd->audio_thread_info.stream.in_channels = dd->noutputs;
 		add_stream(&dd->audio_thread_info.stream, dd->video_output_context,
-				   &audio_codec, fmt->audio_codec, 0, 0, 0);
+				   &audio_codec, fmt->audio_codec, 0, 0, 0, dd->noutputs);
 	}
-	av_dict_set(&opt, "cpu-used", "-8", 0);
-	av_dict_set(&opt, "deadline", "realtime", 0);
+	configure_video(dd->video_thread_info.stream.enc, es, &opt);
 	open_video(dd->drawing_rect.width, dd->drawing_rect.height,
 			   video_codec, &dd->video_thread_info.stream, opt);
+	av_dict_free(&opt);
+	print_video_config(dd->video_thread_info.stream.enc, es);
 	open_audio(audio_codec, &dd->audio_thread_info.stream, opt);
 	av_dump_format(dd->video_output_context, 0, filename, 1);
 	if (!(fmt->flags & AVFMT_NOFILE)) {
@@ -480,6 +709,7 @@ int init_output(DingleDots *dd) {
 				err);
 		return 1;
 	}
+	dd->muxer.start(dd->video_output_context);
 
 	return 0;
 }
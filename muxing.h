@@ -18,6 +18,7 @@ extern "C" {
 #include <libavutil/mathematics.h>
 #include <libavutil/timestamp.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
@@ -28,20 +29,29 @@ extern "C" {
 #include <jack/jack.h>
 #include <jack/ringbuffer.h>
 #include "v4l2_wayland.h"
+#include "frame_pool.h"
 //#include "dingle_dots.h"
 
 #define STREAM_FRAME_RATE 60
 #define STREAM_PIX_FMT AV_PIX_FMT_RGB32
 
 #define SCALE_FLAGS SWS_BICUBIC
+#define ENCODER_DEFAULT_GOP 12
+#define ENCODER_DEFAULT_CRF 23.0
 class DingleDots;
 int write_video_frame(DingleDots *dd, AVFormatContext *oc,
  OutputStream *ost);
 int write_audio_frame(DingleDots *dd, AVFormatContext *oc,
  OutputStream *ost);
 int init_output(DingleDots *dd);
+uint64_t audio_channel_layout(int nchannels);
+void encoder_settings_default(encoder_settings *es);
+int encoder_parse_rate_control(encoder_settings *es, const char *arg);
+int encoder_parse_thread_type(encoder_settings *es, const char *arg);
 void close_stream(OutputStream *ost);
+int audio_ring_write_period(jack_ringbuffer_t *rb, jack_default_audio_sample_t **chans,
+							int nchans, jack_nframes_t nframes);
+int audio_ring_read(jack_ringbuffer_t *rb, float *dst, size_t nsamples);
 extern jack_ringbuffer_t *video_ring_buf, *audio_ring_buf;
 extern volatile int can_capture;
-extern pthread_mutex_t av_thread_lock;
 #endif
@@ -0,0 +1,44 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "notifier.h"
+
+Notifier::Notifier() {
+	fd = -1;
+	pending.store(0);
+}
+
+void Notifier::init() {
+	if (this->fd >= 0) return;
+	this->pending.store(0);
+	this->fd = eventfd(0, EFD_CLOEXEC);
+	if (this->fd < 0) {
+		perror("eventfd");
+		exit(1);
+	}
+}
+
+void Notifier::free() {
+	int fd = this->fd;
+	this->fd = -1;
+	if (fd >= 0) close(fd);
+}
+
+void Notifier::notify() {
+	uint64_t one = 1;
+	if (this->pending.exchange(1, std::memory_order_acq_rel)) return;
+	if (this->fd < 0) return;
+	while (write(this->fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+/* Returns once notify() has been called since the previous wait()
+ * returned. */
+void Notifier::wait() {
+	uint64_t count;
+	while (read(this->fd, &count, sizeof(count)) < 0 && errno == EINTR);
+	this->pending.exchange(0, std::memory_order_acq_rel);
+}
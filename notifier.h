@@ -0,0 +1,23 @@
+#if !defined (_NOTIFIER_H)
+#define _NOTIFIER_H (1)
+
+#include <atomic>
+
+/* One-consumer wakeup built on an eventfd. notify() never takes a lock,
+ * so it is safe from the JACK callback, and since the eventfd latches a
+ * notify() that lands before the consumer sleeps is not lost. The
+ * consumer checks its condition and calls wait() only if it is not yet
+ * met; notifies that arrive while it is awake cost one atomic exchange. */
+class Notifier {
+public:
+	Notifier();
+	void init();
+	void free();
+	void notify();
+	void wait();
+private:
+	int fd;
+	std::atomic<int> pending;
+};
+
+#endif
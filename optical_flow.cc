@@ -0,0 +1,121 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "optical_flow.h"
+
+OpticalFlow::OpticalFlow() {
+	pyramid = NULL;
+}
+
+/* Flow is estimated on level FLOW_LEVEL_SHIFT of the shared pyramid,
+ * which dingle_dots builds once per frame. */
+int OpticalFlow::init(LumaPyramid *pyramid) {
+	this->pyramid = pyramid;
+	return 0;
+}
+
+int OpticalFlow::estimate(double x, double y, double r, flow_vector *out) {
+	const int b = FLOW_BLOCK_SIZE;
+	const int sr = FLOW_SEARCH_RADIUS;
+	const double level_scale = 1 << FLOW_LEVEL_SHIFT;
+	const luma_image *cl = this->pyramid->level(FLOW_LEVEL_SHIFT);
+	const luma_image *pl = this->pyramid->prev_level(FLOW_LEVEL_SHIFT);
+	const uint8_t *c = cl->data;
+	const uint8_t *p = pl->data;
+	const int stride = cl->stride;
+	double cx = x / level_scale;
+	double cy = y / level_scale;
+	double rl = r / level_scale;
+	int istart, jstart, iend, jend;
+	double sum_dx = 0, sum_dy = 0, sum_mag = 0;
+	memset(out, 0, sizeof(*out));
+	if (!this->pyramid->have_prev) return -1;
+	istart = fmax(sr, floor(cx - rl));
+	jstart = fmax(sr, floor(cy - rl));
+	iend = fmin(cl->width - sr - b, ceil(cx + rl) - b);
+	jend = fmin(cl->height - sr - b, ceil(cy + rl) - b);
+	for (int j = jstart; j <= jend; j += b) {
+		for (int i = istart; i <= iend; i += b) {
+			double bx = i + 0.5 * b - cx;
+			double by = j + 0.5 * b - cy;
+			if (bx * bx + by * by > rl * rl) continue;
+			const uint8_t *cb = c + i + j * stride;
+			uint32_t sad0 = flow_block_sad(cb, stride, p + i + j * stride,
+										   stride);
+			uint32_t best = sad0;
+			int best_dx = 0, best_dy = 0;
+			out->nblocks++;
+			if (sad0 < FLOW_MIN_SAD_GAIN) continue;
+			for (int dy = -sr; dy <= sr; dy++) {
+				for (int dx = -sr; dx <= sr; dx++) {
+					if (!dx && !dy) continue;
+					uint32_t sad = flow_block_sad(cb, stride,
+												  p + i + dx + (j + dy) * stride,
+												  stride);
+					if (sad < best) {
+						best = sad;
+						best_dx = dx;
+						best_dy = dy;
+					}
+				}
+			}
+			if (sad0 - best < FLOW_MIN_SAD_GAIN) continue;
+			/* The block came from (i + d) in the previous frame,
+			 * so it moved by -d. */
+			sum_dx -= best_dx;
+			sum_dy -= best_dy;
+			sum_mag += sqrt(best_dx * best_dx + best_dy * best_dy);
+			out->nmoving++;
+		}
+	}
+	if (out->nmoving) {
+		out->dx = level_scale * sum_dx / out->nmoving;
+		out->dy = level_scale * sum_dy / out->nmoving;
+		out->magnitude = level_scale * sum_mag / out->nmoving;
+		out->direction = atan2(out->dy, out->dx);
+	}
+	return out->nmoving;
+}
+
+#if defined(__SSE2__)
+uint32_t flow_block_sad(const uint8_t *a, int astride,
+						const uint8_t *b, int bstride) {
+	__m128i acc = _mm_setzero_si128();
+	for (int j = 0; j < FLOW_BLOCK_SIZE; j += 2) {
+		__m128i va = _mm_unpacklo_epi64(
+					_mm_loadl_epi64((const __m128i *)(a + j * astride)),
+					_mm_loadl_epi64((const __m128i *)(a + (j + 1) * astride)));
+		__m128i vb = _mm_unpacklo_epi64(
+					_mm_loadl_epi64((const __m128i *)(b + j * bstride)),
+					_mm_loadl_epi64((const __m128i *)(b + (j + 1) * bstride)));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+	}
+	return _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+}
+#else
+uint32_t flow_block_sad(const uint8_t *a, int astride,
+						const uint8_t *b, int bstride) {
+	uint32_t sad = 0;
+	for (int j = 0; j < FLOW_BLOCK_SIZE; j++) {
+		for (int i = 0; i < FLOW_BLOCK_SIZE; i++) {
+			sad += abs(a[i + j * astride] - b[i + j * bstride]);
+		}
+	}
+	return sad;
+}
+#endif
+
+uint8_t flow_speed_to_velocity(double speed, double full_scale_speed) {
+	double v = speed / full_scale_speed;
+	if (v > 1.0) v = 1.0;
+	return 1 + (uint8_t)round(126 * v);
+}
+
+uint8_t flow_direction_to_cc(double direction) {
+	return (uint8_t)round(127 * (direction + M_PI) / (2 * M_PI));
+}
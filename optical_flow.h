@@ -0,0 +1,36 @@
+#if !defined (_OPTICAL_FLOW_H)
+#define _OPTICAL_FLOW_H (1)
+
+#include <stdint.h>
+
+#include "luma_pyramid.h"
+
+#define FLOW_LEVEL_SHIFT 2
+#define FLOW_BLOCK_SIZE 8
+#define FLOW_SEARCH_RADIUS 3
+#define FLOW_MIN_SAD_GAIN 64
+
+typedef struct flow_vector {
+	double dx;        // full resolution pixels per frame
+	double dy;
+	double magnitude; // mean speed of the moving blocks
+	double direction; // radians, atan2 of the mean vector
+	int nblocks;
+	int nmoving;
+} flow_vector;
+
+class OpticalFlow {
+public:
+	OpticalFlow();
+	int init(LumaPyramid *pyramid);
+	int estimate(double x, double y, double r, flow_vector *out);
+private:
+	LumaPyramid *pyramid;
+};
+
+uint32_t flow_block_sad(const uint8_t *a, int astride,
+						const uint8_t *b, int bstride);
+uint8_t flow_speed_to_velocity(double speed, double full_scale_speed);
+uint8_t flow_direction_to_cc(double direction);
+
+#endif
@@ -0,0 +1,48 @@
+#if !defined (_SEQLOCK_H)
+#define _SEQLOCK_H (1)
+
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/* Single writer, any number of readers that never block the writer.
+ * Readers copy the protected data and retry if a write overlapped. */
+class SeqLock {
+public:
+	SeqLock() { seq.store(0); }
+	void write_begin() {
+		seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void write_end() {
+		seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+	uint32_t read_begin() const {
+		uint32_t s;
+		while ((s = seq.load(std::memory_order_acquire)) & 1) {
+			sched_yield();
+		}
+		return s;
+	}
+	int read_retry(uint32_t s) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return seq.load(std::memory_order_relaxed) != s;
+	}
+	template <typename T> void store(T *dst, const T *src) {
+		this->write_begin();
+		memcpy(dst, src, sizeof(T));
+		this->write_end();
+	}
+	template <typename T> void load(T *dst, const T *src) const {
+		uint32_t s;
+		do {
+			s = this->read_begin();
+			memcpy(dst, src, sizeof(T));
+		} while (this->read_retry(s));
+	}
+private:
+	std::atomic<uint32_t> seq;
+};
+
+#endif
@@ -83,7 +83,6 @@ void SnapshotShape::set_motion_state(uint8_t state) {
 										   std::bind(&SnapshotShape::set_radius_on, this, std::placeholders::_1), 0.0, final_radius,
 										   this->shutdown_time);
 		this->countdown_radius_easer.start();
-		clock_gettime(CLOCK_MONOTONIC, &this->motion_ts);
 	} else {
 		if (this->motion_state) {
 			if (this->countdown_radius_easer.done()) {
@@ -17,10 +17,19 @@ void SoundShape::init(char *label, uint8_t midi_note, uint8_t midi_channel,
 	this->label = new string(label);
 	this->midi_note = midi_note;
 	this->midi_channel = midi_channel;
+	this->patch = midi_channel % SYNTH_NUM_PATCHES;
 	this->color_normal = color_copy(c);
 	this->color_on = color_lighten(c, 0.95);
 	this->shutdown_time = 0.2;
 	this->on = 0;
+	this->velocity = 64;
+	this->motion_speed = 0;
+	this->motion_direction = 0;
+	this->speed_cc_value = 0;
+	this->direction_cc_value = 0;
+	this->motion_cc_value = 0;
+	this->motion_bend_value = 8192;
+	this->motion_pressure_value = 0;
 
 }
 
@@ -97,6 +106,9 @@ void SoundShape::clear_state() {
 	this->hovered = 0;
 	this->motion_state = 0;
 	this->tld_state = 0;
+	this->blob_state = 0;
+	this->detect_state = 0;
+	this->detection_id = -1;
 	this->mdown = 0;
 	this->active = 0;
 }
@@ -121,57 +133,30 @@ int SoundShape::in(double x, double y) {
 }
 
 int SoundShape::set_on() {
+	jack_nframes_t time = midi_event_frame_time(this->dingle_dots);
 	this->on = 1;
-	midi_queue_new_message(0x90 | this->midi_channel, this->midi_note, 64, this->dingle_dots);
+	if (this->dingle_dots->synth.active) {
+		this->dingle_dots->synth.note_on(this->midi_note, this->midi_channel, this->velocity,
+										 this->patch, time);
+	}
+	midi_queue_message_at(0x90 | this->midi_channel, this->midi_note, this->velocity, time,
+						  this->dingle_dots);
 	gtk_widget_queue_draw(dingle_dots->drawing_area);
 	return 0;
 }
 
 int SoundShape::set_off() {
+	jack_nframes_t time = midi_event_frame_time(this->dingle_dots);
 	this->on = 0;
 	this->double_clicked_on = 0;
-	midi_queue_new_message(0x80 | this->midi_channel, this->midi_note, 0, this->dingle_dots);
+	if (this->dingle_dots->synth.active) {
+		this->dingle_dots->synth.note_off(this->midi_note, this->midi_channel, time);
+	}
+	midi_queue_message_at(0x80 | this->midi_channel, this->midi_note, 0, time, this->dingle_dots);
 	gtk_widget_queue_draw(dingle_dots->drawing_area);
 	return 0;
 }
 
-void SoundShape::tick() {
-	return;
-	if (this->motion_state_to_off) {
-		this->set_motion_state(0);
-	}
-}
-
-double SoundShape::get_secs_since_last_on()
-{
-	struct timespec now_ts;
-	struct timespec diff_ts;
-	double diff_sec;
-	clock_gettime(CLOCK_MONOTONIC, &now_ts);
-	timespec_diff(&this->motion_ts, &now_ts, &diff_ts);
-	diff_sec = timespec_to_seconds(&diff_ts);
-	return diff_sec;
-}
-
-void SoundShape::set_motion_state(uint8_t state) {
-	if (state) {
-		this->motion_state = 1;
-		this->motion_state_to_off = 0;
-		clock_gettime(CLOCK_MONOTONIC, &this->motion_ts);
-	} else {
-		if (this->motion_state) {
-			double diff_sec = get_secs_since_last_on();
-			if (diff_sec >= shutdown_time) {
-				this->motion_state = 0;
-				this->motion_state_to_off = 0;
-
-			} else {
-				this->motion_state_to_off = 1;
-			}
-		}
-	}
-}
-
 int color_init(color *c, double r, double g, double b, double a) {
 	c->r = r;
 	c->g = g;
@@ -30,25 +30,33 @@ public:
 	int in(double x, double y);
 	int virtual set_on();
 	virtual int set_off();
-	void tick();
 	int is_on();
 	void clear_state();
-	virtual void set_motion_state(uint8_t state);
 	//	private:
 	double shutdown_time;
 	uint8_t on;
 	uint8_t double_clicked_on;
 	uint8_t motion_state;
 	uint8_t motion_state_to_off;
-	struct timespec motion_ts;
 	uint8_t tld_state;
+	uint8_t blob_state;
+	uint8_t detect_state;
+	int detection_id;
+	uint8_t velocity;
+	double motion_speed;
+	double motion_direction;
+	uint8_t speed_cc_value;
+	uint8_t direction_cc_value;
+	int motion_cc_value;
+	int motion_bend_value;
+	int motion_pressure_value;
 	double r;
 	std::string *label;
 	uint8_t midi_note;
 	uint8_t midi_channel;
+	uint8_t patch;
 	color color_normal;
 	color color_on;
-	double get_secs_since_last_on();
 
 };
 
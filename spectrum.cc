@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spectrum.h"
+#include "fft_plans.h"
+
+SpectrumAnalyzer::SpectrumAnalyzer() {
+	active = 0;
+	size = 0;
+	nbins = 0;
+	overruns = 0;
+	ring = NULL;
+	quit = 0;
+	window = history = in = NULL;
+	out = NULL;
+	block = NULL;
+	plan = NULL;
+	mags = NULL;
+	nframes_analyzed = 0;
+}
+
+int SpectrumAnalyzer::init(int size) {
+	if (size < SPECTRUM_MIN_SIZE || size > SPECTRUM_MAX_SIZE || (size & (size - 1))) {
+		fprintf(stderr, "FFT size must be a power of two from %d to %d\n",
+				SPECTRUM_MIN_SIZE, SPECTRUM_MAX_SIZE);
+		return -1;
+	}
+	this->size = size;
+	this->nbins = size / 2 + 1;
+	this->hop = size / 2;
+	this->overruns = 0;
+	this->nframes_analyzed = 0;
+	this->ring = jack_ringbuffer_create(SPECTRUM_RING_BLOCKS * size *
+										sizeof(jack_default_audio_sample_t));
+	this->window = fftw_alloc_real(size);
+	this->history = fftw_alloc_real(size);
+	this->in = fftw_alloc_real(size);
+	this->out = fftw_alloc_complex(this->nbins);
+	this->block = (jack_default_audio_sample_t *)malloc(sizeof(jack_default_audio_sample_t) * this->hop);
+	this->mags = (float *)calloc(this->nbins, sizeof(float));
+	if (!this->ring || !this->window || !this->history || !this->in ||
+			!this->out || !this->block || !this->mags) {
+		fprintf(stderr, "Could not allocate spectrum analyzer\n");
+		exit(1);
+	}
+	jack_ringbuffer_mlock(this->ring);
+	/* Periodic Hann, so windows at half-size hops sum to a constant. */
+	for (int i = 0; i < size; i++) {
+		this->window[i] = 0.5 * (1 - cos(2 * M_PI * i / size));
+	}
+	memset(this->history, 0, sizeof(double) * size);
+	fft_plan_lock();
+	this->plan = fftw_plan_dft_r2c_1d(size, this->in, this->out, FFTW_MEASURE);
+	fft_plan_unlock();
+	this->quit = 0;
+	this->data_ready.init();
+	if (pthread_create(&this->thread_id, NULL, SpectrumAnalyzer::thread, this)) {
+		fprintf(stderr, "Could not start spectrum thread\n");
+		exit(1);
+	}
+	pthread_setname_np(this->thread_id, "v4l2_wl_fft");
+	this->active = 1;
+	return 0;
+}
+
+void SpectrumAnalyzer::free() {
+	if (!this->ring) return;
+	this->active = 0;
+	this->quit = 1;
+	this->data_ready.notify();
+	pthread_join(this->thread_id, NULL);
+	this->data_ready.free();
+	fft_plan_lock();
+	fftw_destroy_plan(this->plan);
+	fft_plan_unlock();
+	fftw_free(this->window);
+	fftw_free(this->history);
+	fftw_free(this->in);
+	fftw_free(this->out);
+	::free(this->block);
+	::free(this->mags);
+	jack_ringbuffer_free(this->ring);
+	this->ring = NULL;
+}
+
+/* Called from the JACK process callback. */
+void SpectrumAnalyzer::write(const jack_default_audio_sample_t *in, jack_nframes_t nframes) {
+	size_t len = nframes * sizeof(jack_default_audio_sample_t);
+	if (!this->active) return;
+	if (jack_ringbuffer_write_space(this->ring) < len) {
+		this->overruns.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	jack_ringbuffer_write(this->ring, (const char *)in, len);
+	this->data_ready.notify();
+}
+
+/* Copies the newest magnitudes into mags, which must hold nbins floats,
+ * and returns how many FFTs have been run so far. */
+uint64_t SpectrumAnalyzer::read(float *mags) const {
+	uint64_t n;
+	uint32_t s;
+	do {
+		s = this->mags_lock.read_begin();
+		memcpy(mags, this->mags, sizeof(float) * this->nbins);
+		n = this->nframes_analyzed;
+	} while (this->mags_lock.read_retry(s));
+	return n;
+}
+
+void SpectrumAnalyzer::analyze() {
+	const double scale = 4.0 / this->size;
+	memmove(this->history, this->history + this->hop, sizeof(double) * (this->size - this->hop));
+	for (int i = 0; i < this->hop; i++) {
+		this->history[this->size - this->hop + i] = this->block[i];
+	}
+	for (int i = 0; i < this->size; i++) {
+		this->in[i] = this->history[i] * this->window[i];
+	}
+	fftw_execute(this->plan);
+	this->mags_lock.write_begin();
+	for (int k = 0; k < this->nbins; k++) {
+		this->mags[k] = scale * sqrt(this->out[k][0] * this->out[k][0] +
+									 this->out[k][1] * this->out[k][1]);
+	}
+	this->nframes_analyzed++;
+	this->mags_lock.write_end();
+}
+
+void *SpectrumAnalyzer::thread(void *arg) {
+	SpectrumAnalyzer *sa = (SpectrumAnalyzer *)arg;
+	size_t hop_len = sa->hop * sizeof(jack_default_audio_sample_t);
+	while (!sa->quit) {
+		while (jack_ringbuffer_read_space(sa->ring) >= hop_len) {
+			jack_ringbuffer_read(sa->ring, (char *)sa->block, hop_len);
+			sa->analyze();
+		}
+		sa->data_ready.wait();
+	}
+	return NULL;
+}
@@ -0,0 +1,54 @@
+#if !defined (_SPECTRUM_H)
+#define _SPECTRUM_H (1)
+
+#include <pthread.h>
+#include <atomic>
+#include <stdint.h>
+#include <fftw3.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "notifier.h"
+#include "seqlock.h"
+
+#define SPECTRUM_DEFAULT_SIZE 1024
+#define SPECTRUM_MIN_SIZE 64
+#define SPECTRUM_MAX_SIZE 8192
+#define SPECTRUM_RING_BLOCKS 8     // ring capacity in FFT sizes
+#define SPECTRUM_RANGE_DB 60.0     // dB below full scale shown by RENDER_FFT
+
+/* Magnitude spectrum of one input channel. The JACK callback only copies
+ * samples into a lock-free ring; a non real time thread runs Hann
+ * windowed real FFTs at half-size hops and publishes the bin
+ * magnitudes, scaled so a full scale sine reads 1.0, through a seqlock. */
+class SpectrumAnalyzer {
+public:
+	SpectrumAnalyzer();
+	int init(int size);
+	void free();
+	void write(const jack_default_audio_sample_t *in, jack_nframes_t nframes);
+	uint64_t read(float *mags) const;
+	int active;                // write() does nothing until init()
+	int size;
+	int nbins;
+	std::atomic<long> overruns;   // written by the JACK thread, relaxed
+private:
+	static void *thread(void *arg);
+	void analyze();
+	jack_ringbuffer_t *ring;
+	pthread_t thread_id;
+	Notifier data_ready;
+	std::atomic<int> quit;      // set by free(), polled by the thread
+	int hop;
+	double *window;
+	double *history;
+	double *in;
+	fftw_complex *out;
+	jack_default_audio_sample_t *block;
+	fftw_plan plan;
+	SeqLock mags_lock;
+	float *mags;
+	uint64_t nframes_analyzed;
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "synth.h"
+#include "midi.h"
+
+static const synth_patch patches[SYNTH_NUM_PATCHES] = {
+	/* name     fm table ratio index decay  attack decay sustain release */
+	{ "sine",   0, 0,    0.0f, 0.0f, 1.0f,  0.01f, 0.5f, 0.8f, 0.2f },
+	{ "organ",  0, 1,    0.0f, 0.0f, 1.0f,  0.005f, 0.1f, 1.0f, 0.05f },
+	{ "saw",    0, 2,    0.0f, 0.0f, 1.0f,  0.01f, 0.3f, 0.7f, 0.15f },
+	{ "bell",   1, 0,    3.5f, 1.0f, 1.5f,  0.002f, 1.2f, 0.0f, 0.8f },
+	{ "epiano", 1, 0,    1.0f, 0.4f, 0.4f,  0.003f, 0.8f, 0.3f, 0.3f },
+};
+#define SYNTH_NUM_TABLES 3
+
+Synth::Synth() {
+	active = 0;
+	dropped_events = 0;
+	ring = NULL;
+	tables = NULL;
+	nstarted = 0;
+}
+
+/* One cycle of a sum of harmonics, normalized to a peak of 1. */
+static void fill_table(float *t, const float *amps, int nharmonics) {
+	float peak = 0;
+	for (int i = 0; i < SYNTH_TABLE_SIZE; i++) {
+		double x = 2 * M_PI * i / SYNTH_TABLE_SIZE;
+		double v = 0;
+		for (int h = 0; h < nharmonics; h++) {
+			v += amps[h] * sin((h + 1) * x);
+		}
+		t[i] = v;
+		if (fabsf(t[i]) > peak) peak = fabsf(t[i]);
+	}
+	for (int i = 0; i < SYNTH_TABLE_SIZE; i++) {
+		t[i] /= peak;
+	}
+}
+
+void Synth::init(jack_nframes_t sample_rate) {
+	float sine[1] = { 1.0f };
+	float organ[8] = { 1.0f, 0.6f, 0.4f, 0.3f, 0.0f, 0.2f, 0.0f, 0.15f };
+	float saw[8];
+	this->sample_rate = sample_rate;
+	this->ring = jack_ringbuffer_create(SYNTH_MAX_EVENTS * sizeof(synth_event));
+	this->tables = (float *)malloc(sizeof(float) * SYNTH_NUM_TABLES * SYNTH_TABLE_SIZE);
+	if (!this->ring || !this->tables) {
+		fprintf(stderr, "Could not allocate synth\n");
+		exit(1);
+	}
+	jack_ringbuffer_mlock(this->ring);
+	/* Eight harmonics keep the saw below Nyquist up to about C7. */
+	for (int h = 0; h < 8; h++) {
+		saw[h] = 1.0f / (h + 1);
+	}
+	fill_table(this->tables, sine, 1);
+	fill_table(this->tables + SYNTH_TABLE_SIZE, organ, 8);
+	fill_table(this->tables + 2 * SYNTH_TABLE_SIZE, saw, 8);
+	for (int p = 0; p < SYNTH_NUM_PATCHES; p++) {
+		const synth_patch *pa = &patches[p];
+		this->attack_step[p] = 1.0f / (pa->attack * sample_rate);
+		this->decay_coef[p] = expf(-SYNTH_BLOCK / (pa->decay * sample_rate));
+		this->release_coef[p] = expf(-SYNTH_BLOCK / (pa->release * sample_rate));
+		this->index_coef[p] = expf(-SYNTH_BLOCK / (pa->index_decay * sample_rate));
+	}
+	memset(this->voices, 0, sizeof(this->voices));
+	this->nstarted = 0;
+	this->dropped_events = 0;
+	this->active = 1;
+}
+
+void Synth::free() {
+	if (!this->ring) return;
+	this->active = 0;
+	jack_ringbuffer_free(this->ring);
+	::free(this->tables);
+	this->ring = NULL;
+	this->tables = NULL;
+}
+
+const char *Synth::patch_name(int patch) {
+	if (patch < 0 || patch >= SYNTH_NUM_PATCHES) return "none";
+	return patches[patch].name;
+}
+
+void Synth::queue(synth_event *ev) {
+	if (!this->active) return;
+	if (jack_ringbuffer_write_space(this->ring) < sizeof(*ev)) {
+		this->dropped_events++;
+		return;
+	}
+	jack_ringbuffer_write(this->ring, (const char *)ev, sizeof(*ev));
+}
+
+void Synth::note_on(uint8_t note, uint8_t channel, uint8_t velocity,
+					uint8_t patch, jack_nframes_t time) {
+	synth_event ev;
+	ev.time = time;
+	ev.on = 1;
+	ev.note = note;
+	ev.channel = channel;
+	ev.velocity = velocity;
+	ev.patch = patch % SYNTH_NUM_PATCHES;
+	this->queue(&ev);
+}
+
+void Synth::note_off(uint8_t note, uint8_t channel, jack_nframes_t time) {
+	synth_event ev;
+	ev.time = time;
+	ev.on = 0;
+	ev.note = note;
+	ev.channel = channel;
+	ev.velocity = 0;
+	ev.patch = 0;
+	this->queue(&ev);
+}
+
+/* Takes a free voice, else the oldest released one, else the oldest. */
+void Synth::apply(synth_event *ev) {
+	synth_voice *v = NULL;
+	if (!ev->on) {
+		for (int i = 0; i < SYNTH_MAX_VOICES; i++) {
+			synth_voice *w = &this->voices[i];
+			if (w->active && w->stage != SYNTH_RELEASE &&
+					w->note == ev->note && w->channel == ev->channel) {
+				w->stage = SYNTH_RELEASE;
+			}
+		}
+		return;
+	}
+	for (int i = 0; i < SYNTH_MAX_VOICES; i++) {
+		synth_voice *w = &this->voices[i];
+		if (!w->active) {
+			v = w;
+			break;
+		}
+		if (!v || (w->stage == SYNTH_RELEASE && v->stage != SYNTH_RELEASE) ||
+				((w->stage == SYNTH_RELEASE) == (v->stage == SYNTH_RELEASE) &&
+				 w->started < v->started)) {
+			v = w;
+		}
+	}
+	const synth_patch *pa = &patches[ev->patch];
+	float freq = midi_to_freq(ev->note);
+	v->active = 1;
+	v->stage = SYNTH_ATTACK;
+	v->note = ev->note;
+	v->channel = ev->channel;
+	v->patch = pa;
+	v->started = this->nstarted++;
+	v->phase = 0;
+	v->inc = freq / this->sample_rate;
+	v->mod_phase = 0;
+	v->mod_inc = pa->ratio * v->inc;
+	v->amp = SYNTH_GAIN * ev->velocity / 127.0f;
+	v->env = 0;
+	v->index = pa->index;
+}
+
+#if defined(__SSE2__)
+/* sin(2 pi x) to within about 0.001, for any x. */
+static inline __m128 sin_cycles_ps(__m128 x) {
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	x = _mm_sub_ps(x, _mm_cvtepi32_ps(_mm_cvtps_epi32(x)));
+	__m128 ax = _mm_andnot_ps(sign_mask, x);
+	__m128 y = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(8.0f), x),
+						  _mm_mul_ps(_mm_set1_ps(16.0f), _mm_mul_ps(x, ax)));
+	__m128 ay = _mm_andnot_ps(sign_mask, y);
+	return _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(0.225f),
+									_mm_sub_ps(_mm_mul_ps(y, ay), y)));
+}
+#endif
+
+static inline float sin_cycles(float x) {
+	x -= floorf(x + 0.5f);
+	float y = 8.0f * x - 16.0f * x * fabsf(x);
+	return y + 0.225f * (y * fabsf(y) - y);
+}
+
+/* Raw oscillator output for n samples, without envelope. */
+void Synth::render_voice(synth_voice *v, float *buf, int n) {
+	int i = 0;
+	if (v->patch->fm) {
+		float index = v->index;
+#if defined(__SSE2__)
+		const __m128 ramp = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 inc = _mm_set1_ps(v->inc);
+		const __m128 mod_inc = _mm_set1_ps(v->mod_inc);
+		const __m128 vindex = _mm_set1_ps(index);
+		for (; i + 4 <= n; i += 4) {
+			__m128 p = _mm_add_ps(_mm_set1_ps(v->phase), _mm_mul_ps(ramp, inc));
+			__m128 mp = _mm_add_ps(_mm_set1_ps(v->mod_phase), _mm_mul_ps(ramp, mod_inc));
+			__m128 mod = _mm_mul_ps(vindex, sin_cycles_ps(mp));
+			_mm_storeu_ps(buf + i, sin_cycles_ps(_mm_add_ps(p, mod)));
+			v->phase += 4 * v->inc;
+			v->mod_phase += 4 * v->mod_inc;
+			v->phase -= floorf(v->phase);
+			v->mod_phase -= floorf(v->mod_phase);
+		}
+#endif
+		for (; i < n; i++) {
+			buf[i] = sin_cycles(v->phase + index * sin_cycles(v->mod_phase));
+			v->phase += v->inc;
+			v->mod_phase += v->mod_inc;
+			v->phase -= floorf(v->phase);
+			v->mod_phase -= floorf(v->mod_phase);
+		}
+	} else {
+		const float *t = this->tables + v->patch->table * SYNTH_TABLE_SIZE;
+		for (; i < n; i++) {
+			float x = v->phase * SYNTH_TABLE_SIZE;
+			int j = (int)x;
+			float frac = x - j;
+			float a = t[j & (SYNTH_TABLE_SIZE - 1)];
+			float b = t[(j + 1) & (SYNTH_TABLE_SIZE - 1)];
+			buf[i] = a + frac * (b - a);
+			v->phase += v->inc;
+			if (v->phase >= 1.0f) v->phase -= 1.0f;
+		}
+	}
+}
+
+/* Advances the envelope and FM index by n samples and returns the
+ * envelope level at the end. Full blocks use the precomputed
+ * coefficients; the short blocks either side of an event pay for powf. */
+float Synth::step_envelope(synth_voice *v, int n) {
+	int p = v->patch - patches;
+	float k = (float)n / SYNTH_BLOCK;
+	float index_coef = n == SYNTH_BLOCK ? this->index_coef[p] : powf(this->index_coef[p], k);
+	v->index *= index_coef;
+	switch (v->stage) {
+		case SYNTH_ATTACK:
+			v->env += this->attack_step[p] * n;
+			if (v->env >= 1.0f) {
+				v->env = 1.0f;
+				v->stage = SYNTH_DECAY;
+			}
+			break;
+		case SYNTH_DECAY: {
+			float c = n == SYNTH_BLOCK ? this->decay_coef[p] : powf(this->decay_coef[p], k);
+			v->env = v->patch->sustain + (v->env - v->patch->sustain) * c;
+			break;
+		}
+		default: {
+			float c = n == SYNTH_BLOCK ? this->release_coef[p] : powf(this->release_coef[p], k);
+			v->env *= c;
+			break;
+		}
+	}
+	return v->env;
+}
+
+/* dst[i] += src[i] * (g0 + i * dg) */
+static void mix_ramp(jack_default_audio_sample_t *dst, const float *src, int n,
+					 float g0, float dg) {
+	int i = 0;
+#if defined(__SSE2__)
+	__m128 g = _mm_add_ps(_mm_set1_ps(g0),
+						  _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(dg)));
+	const __m128 dg4 = _mm_set1_ps(4.0f * dg);
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+										  _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+		g = _mm_add_ps(g, dg4);
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] += src[i] * (g0 + i * dg);
+	}
+}
+
+void Synth::render_segment(jack_default_audio_sample_t **out, int nports,
+						   jack_nframes_t offset, jack_nframes_t n) {
+	while (n > 0) {
+		int len = n < SYNTH_BLOCK ? n : SYNTH_BLOCK;
+		for (int i = 0; i < SYNTH_MAX_VOICES; i++) {
+			synth_voice *v = &this->voices[i];
+			if (!v->active) continue;
+			float g0 = v->amp * v->env;
+			this->render_voice(v, this->block, len);
+			float g1 = v->amp * this->step_envelope(v, len);
+			for (int c = 0; c < nports; c++) {
+				mix_ramp(out[c] + offset, this->block, len, g0, (g1 - g0) / len);
+			}
+			if (v->stage == SYNTH_RELEASE && v->env < SYNTH_SILENT) {
+				v->active = 0;
+			}
+		}
+		offset += len;
+		n -= len;
+	}
+}
+
+/* Called from the JACK process callback with jack_last_frame_time().
+ * Each event takes effect at its own frame; late ones at the start of
+ * what is left of the period. */
+void Synth::render(jack_default_audio_sample_t **out, int nports,
+				   jack_nframes_t nframes, jack_nframes_t frame_time) {
+	synth_event ev;
+	jack_nframes_t pos = 0;
+	if (!this->active) return;
+	while (jack_ringbuffer_peek(this->ring, (char *)&ev, sizeof(ev)) == sizeof(ev)) {
+		int32_t t = (int32_t)(ev.time - frame_time);
+		if (t >= (int32_t)nframes) break;
+		if (t < (int32_t)pos) t = pos;
+		this->render_segment(out, nports, pos, t - pos);
+		pos = t;
+		this->apply(&ev);
+		jack_ringbuffer_read_advance(this->ring, sizeof(ev));
+	}
+	this->render_segment(out, nports, pos, nframes - pos);
+}
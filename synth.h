@@ -0,0 +1,106 @@
+#if !defined (_SYNTH_H)
+#define _SYNTH_H (1)
+
+#include <stdint.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#define SYNTH_MAX_VOICES 32
+#define SYNTH_TABLE_SIZE 2048      // samples per wavetable cycle, a power of two
+#define SYNTH_BLOCK 64             // envelopes advance once per block
+#define SYNTH_MAX_EVENTS 256
+#define SYNTH_GAIN 0.15f           // per voice, before velocity
+#define SYNTH_SILENT 1e-4f         // released voices below this level are freed
+
+typedef enum {
+	SYNTH_PATCH_SINE = 0,
+	SYNTH_PATCH_ORGAN,
+	SYNTH_PATCH_SAW,
+	SYNTH_PATCH_BELL,
+	SYNTH_PATCH_EPIANO,
+	SYNTH_NUM_PATCHES
+} synth_patches;
+
+struct synth_patch {
+	const char *name;
+	int fm;              // two operator FM instead of a wavetable
+	int table;           // wavetable, when not fm
+	float ratio;         // modulator to carrier frequency
+	float index;         // peak modulation index, in carrier cycles
+	float index_decay;   // seconds for the index to fall by 1/e
+	float attack;        // seconds
+	float decay;         // seconds to fall by 1/e toward sustain
+	float sustain;       // level
+	float release;       // seconds to fall by 1/e
+};
+
+struct synth_event {
+	jack_nframes_t time;
+	uint8_t on;
+	uint8_t note;
+	uint8_t channel;
+	uint8_t velocity;
+	uint8_t patch;
+};
+
+typedef enum {
+	SYNTH_ATTACK = 0,
+	SYNTH_DECAY,
+	SYNTH_RELEASE
+} synth_stages;
+
+struct synth_voice {
+	int active;
+	int stage;
+	uint8_t note;
+	uint8_t channel;
+	const synth_patch *patch;
+	uint64_t started;
+	float phase;
+	float inc;
+	float mod_phase;
+	float mod_inc;
+	float amp;
+	float env;
+	float index;
+};
+
+/* Polyphonic voices rendered straight into the JACK outputs. note_on()
+ * and note_off() run on the GUI thread and only push an event onto a
+ * lock-free ring; render() runs in the JACK callback, applies each event
+ * at its own frame within the period and never allocates. Voices are
+ * rendered a block at a time with SSE sine approximations for FM and
+ * SSE envelope ramps for mixing. */
+class Synth {
+public:
+	Synth();
+	void init(jack_nframes_t sample_rate);
+	void free();
+	void note_on(uint8_t note, uint8_t channel, uint8_t velocity,
+				 uint8_t patch, jack_nframes_t time);
+	void note_off(uint8_t note, uint8_t channel, jack_nframes_t time);
+	void render(jack_default_audio_sample_t **out, int nports,
+				jack_nframes_t nframes, jack_nframes_t frame_time);
+	static const char *patch_name(int patch);
+	int active;
+	long dropped_events;
+private:
+	void queue(synth_event *ev);
+	void apply(synth_event *ev);
+	void render_voice(synth_voice *v, float *buf, int n);
+	float step_envelope(synth_voice *v, int n);
+	void render_segment(jack_default_audio_sample_t **out, int nports,
+						jack_nframes_t offset, jack_nframes_t n);
+	jack_ringbuffer_t *ring;
+	float sample_rate;
+	float *tables;
+	float block[SYNTH_BLOCK];
+	synth_voice voices[SYNTH_MAX_VOICES];
+	uint64_t nstarted;
+	float attack_step[SYNTH_NUM_PATCHES];   // per sample
+	float decay_coef[SYNTH_NUM_PATCHES];    // per block
+	float release_coef[SYNTH_NUM_PATCHES];  // per block
+	float index_coef[SYNTH_NUM_PATCHES];    // per block
+};
+
+#endif
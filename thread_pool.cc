@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool() {
+	nthreads = 0;
+	quit = 0;
+	threads = NULL;
+	jobs = NULL;
+}
+
+int ThreadPool::default_nthreads() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 1 ? n : 1;
+}
+
+/* nthreads counts the calling thread, so nthreads - 1 workers are
+ * started and a pool of 1 runs everything inline. */
+int ThreadPool::init(int nthreads) {
+	this->nthreads = nthreads < 1 ? 1 : nthreads;
+	this->quit = 0;
+	this->jobs = NULL;
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->work_ready, NULL);
+	pthread_cond_init(&this->work_done, NULL);
+	this->threads = (pthread_t *)calloc(this->nthreads, sizeof(pthread_t));
+	for (int i = 1; i < this->nthreads; i++) {
+		if (pthread_create(&this->threads[i], NULL, ThreadPool::thread, this)) {
+			fprintf(stderr, "Could not start thread pool worker\n");
+			exit(1);
+		}
+		pthread_setname_np(this->threads[i], "v4l2_wl_pool");
+	}
+	return 0;
+}
+
+void ThreadPool::free() {
+	pthread_mutex_lock(&this->lock);
+	this->quit = 1;
+	pthread_cond_broadcast(&this->work_ready);
+	pthread_mutex_unlock(&this->lock);
+	for (int i = 1; i < this->nthreads; i++) {
+		pthread_join(this->threads[i], NULL);
+	}
+	::free(this->threads);
+	this->threads = NULL;
+	this->nthreads = 0;
+}
+
+int ThreadPool::get_nthreads() const {
+	return nthreads;
+}
+
+/* Called with the lock held; returns with it held. */
+int ThreadPool::run_one(struct thread_pool_job *job) {
+	int task = job->next_task++;
+	if (job->next_task == job->ntasks) {
+		struct thread_pool_job **pj = &this->jobs;
+		while (*pj != job) pj = &(*pj)->next;
+		*pj = job->next;
+	}
+	pthread_mutex_unlock(&this->lock);
+	job->func(task, job->arg);
+	pthread_mutex_lock(&this->lock);
+	if (++job->ndone == job->ntasks) {
+		pthread_cond_broadcast(&this->work_done);
+	}
+	return task;
+}
+
+void ThreadPool::parallel_for(int ntasks, thread_pool_func func, void *arg) {
+	struct thread_pool_job job;
+	if (ntasks <= 0) return;
+	if (this->nthreads <= 1 || ntasks == 1) {
+		for (int i = 0; i < ntasks; i++) func(i, arg);
+		return;
+	}
+	job.func = func;
+	job.arg = arg;
+	job.ntasks = ntasks;
+	job.next_task = 0;
+	job.ndone = 0;
+	job.next = NULL;
+	pthread_mutex_lock(&this->lock);
+	struct thread_pool_job **pj = &this->jobs;
+	while (*pj) pj = &(*pj)->next;
+	*pj = &job;
+	pthread_cond_broadcast(&this->work_ready);
+	while (job.next_task < job.ntasks) {
+		this->run_one(&job);
+	}
+	while (job.ndone < job.ntasks) {
+		pthread_cond_wait(&this->work_done, &this->lock);
+	}
+	pthread_mutex_unlock(&this->lock);
+}
+
+void *ThreadPool::thread(void *arg) {
+	ThreadPool *pool = (ThreadPool *)arg;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->quit) {
+		if (pool->jobs) {
+			pool->run_one(pool->jobs);
+		} else {
+			pthread_cond_wait(&pool->work_ready, &pool->lock);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
@@ -0,0 +1,41 @@
+#if !defined (_THREAD_POOL_H)
+#define _THREAD_POOL_H (1)
+
+#include <pthread.h>
+
+typedef void (*thread_pool_func)(int task, void *arg);
+
+struct thread_pool_job {
+	thread_pool_func func;
+	void *arg;
+	int ntasks;
+	int next_task;
+	int ndone;
+	struct thread_pool_job *next;
+};
+
+/* Fixed set of workers shared by every stage that splits a frame's
+ * work into independent tasks. parallel_for may be called from several
+ * threads at once; the caller runs tasks too and returns only once all
+ * of its own tasks have finished. */
+class ThreadPool {
+public:
+	ThreadPool();
+	int init(int nthreads);
+	void free();
+	void parallel_for(int ntasks, thread_pool_func func, void *arg);
+	int get_nthreads() const;
+	static int default_nthreads();
+private:
+	static void *thread(void *arg);
+	int run_one(struct thread_pool_job *job);
+	int nthreads;
+	int quit;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	struct thread_pool_job *jobs;
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tld_worker.h"
+
+TldFrames::TldFrames() {
+	frames = NULL;
+	latest = NULL;
+	nframes = 0;
+	next_seq = 1;
+	latest_seq = 0;
+}
+
+int TldFrames::init(int width, int height, int stride, int nframes) {
+	this->width = width;
+	this->height = height;
+	this->stride = stride;
+	this->nframes = nframes;
+	this->frames = (tld_frame *)calloc(nframes, sizeof(tld_frame));
+	if (!this->frames) {
+		fprintf(stderr, "Could not allocate tracker frames\n");
+		exit(1);
+	}
+	for (int i = 0; i < nframes; i++) {
+		tld_frame *f = &this->frames[i];
+		f->data = (uint8_t *)aligned_alloc(32, stride * height);
+		if (!f->data) {
+			fprintf(stderr, "Could not allocate tracker frame\n");
+			exit(1);
+		}
+		f->mat = ccv_dense_matrix(height, width, CCV_8U | CCV_C1, f->data, 0);
+		f->mat.step = stride;
+	}
+	this->latest = NULL;
+	this->next_seq = 1;
+	this->latest_seq = 0;
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->data_ready, NULL);
+	return 0;
+}
+
+void TldFrames::free() {
+	for (int i = 0; i < this->nframes; i++) {
+		::free(this->frames[i].data);
+	}
+	::free(this->frames);
+	this->frames = NULL;
+	this->latest = NULL;
+	this->nframes = 0;
+}
+
+/* Copy the frame into an unused buffer and make it the latest. If every
+ * buffer is still in use the frame is dropped. */
+void TldFrames::publish(const luma_image *l, const struct timespec *ts) {
+	tld_frame *f = NULL;
+	pthread_mutex_lock(&this->lock);
+	for (int i = 0; i < this->nframes; i++) {
+		if (!this->frames[i].refs) {
+			f = &this->frames[i];
+			f->refs = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&this->lock);
+	if (!f) return;
+	memcpy(f->data, l->data, this->stride * this->height);
+	f->ts = *ts;
+	f->seq = this->next_seq++;
+	pthread_mutex_lock(&this->lock);
+	if (this->latest) this->latest->refs--;
+	this->latest = f;
+	this->latest_seq = f->seq;
+	pthread_cond_broadcast(&this->data_ready);
+	pthread_mutex_unlock(&this->lock);
+}
+
+/* Called with the lock held. */
+tld_frame *TldFrames::acquire_latest() {
+	if (this->latest) this->latest->refs++;
+	return this->latest;
+}
+
+/* Called with the lock held. */
+void TldFrames::release(tld_frame *f) {
+	f->refs--;
+}
+
+TldWorker::TldWorker() {
+	frames = NULL;
+	tracking = 0;
+	tld = NULL;
+	prev = NULL;
+	running_type = -1;
+	quit = 0;
+	memset(&box, 0, sizeof(box));
+}
+
+int TldWorker::init(TldFrames *frames) {
+	this->frames = frames;
+	this->last_seq = 0;
+	this->quit = 0;
+	this->start_pending = 0;
+	this->stop_pending = 0;
+	this->running_type = -1;
+	this->tracking = 0;
+	if (pthread_create(&this->thread_id, NULL, TldWorker::thread, this)) {
+		fprintf(stderr, "Could not start tracker thread\n");
+		exit(1);
+	}
+	pthread_setname_np(this->thread_id, "v4l2_wl_tld");
+	return 0;
+}
+
+void TldWorker::free() {
+	pthread_mutex_lock(&this->frames->lock);
+	this->quit = 1;
+	pthread_cond_broadcast(&this->frames->data_ready);
+	pthread_mutex_unlock(&this->frames->lock);
+	pthread_join(this->thread_id, NULL);
+	if (this->tld) ccv_tld_free(this->tld);
+	this->tld = NULL;
+	this->mosse.free();
+	this->running_type = -1;
+	if (this->prev) {
+		pthread_mutex_lock(&this->frames->lock);
+		this->frames->release(this->prev);
+		pthread_mutex_unlock(&this->frames->lock);
+		this->prev = NULL;
+	}
+}
+
+/* The new tracker is created from the next frame the worker picks up. */
+void TldWorker::start(ccv_rect_t box, int type) {
+	pthread_mutex_lock(&this->frames->lock);
+	this->start_box = box;
+	this->start_type = type;
+	this->start_pending = 1;
+	this->stop_pending = 0;
+	pthread_mutex_unlock(&this->frames->lock);
+	this->tracking = 1;
+}
+
+void TldWorker::stop() {
+	if (!this->tracking) return;
+	pthread_mutex_lock(&this->frames->lock);
+	this->start_pending = 0;
+	this->stop_pending = 1;
+	pthread_cond_broadcast(&this->frames->data_ready);
+	pthread_mutex_unlock(&this->frames->lock);
+	this->tracking = 0;
+}
+
+void TldWorker::read_box(tld_box *out) const {
+	this->box_lock.load(out, &this->box);
+}
+
+/* Returns the frame reference the worker no longer needs. */
+tld_frame *TldWorker::process(tld_frame *f, int do_start, int do_stop,
+							  ccv_rect_t start_box, int start_type) {
+	tld_box result;
+	tld_frame *done;
+	if (do_stop || do_start) {
+		if (this->tld) ccv_tld_free(this->tld);
+		this->tld = NULL;
+		this->mosse.free();
+		this->running_type = -1;
+	}
+	if (do_stop) {
+		done = this->prev;
+		this->prev = NULL;
+		memset(&result, 0, sizeof(result));
+		this->box_lock.store(&this->box, &result);
+		return done;
+	}
+	result.rect = start_box;
+	result.found = 0;
+	if (do_start) {
+		this->running_type = start_type;
+	}
+	if (this->running_type == TRACKER_MOSSE) {
+		luma_image l = { f->data, this->frames->width, this->frames->height,
+			this->frames->stride };
+		if (do_start) {
+			this->mosse.init(&l, start_box.x, start_box.y,
+							 start_box.width, start_box.height);
+		} else if (this->mosse.track(&l)) {
+			result.rect = ccv_rect(lround(this->mosse.cx - 0.5 * this->mosse.box_width),
+								   lround(this->mosse.cy - 0.5 * this->mosse.box_height),
+								   this->mosse.box_width, this->mosse.box_height);
+			result.found = 1;
+		}
+	} else {
+		if (do_start) {
+			this->tld = ccv_tld_new(&f->mat, start_box, ccv_tld_default_params);
+		} else if (this->prev) {
+			ccv_tld_info_t info;
+			ccv_comp_t comp = ccv_tld_track_object(this->tld, &this->prev->mat, &f->mat, &info);
+			result.rect = comp.rect;
+			result.found = this->tld->found && comp.rect.width && comp.rect.height;
+		}
+	}
+	done = this->prev;
+	this->prev = f;
+	result.ts = f->ts;
+	result.frame = f->seq;
+	if (do_start || result.found) {
+		this->box_lock.store(&this->box, &result);
+	} else {
+		tld_box last;
+		this->box_lock.load(&last, &this->box);
+		last.found = 0;
+		last.ts = result.ts;
+		last.frame = result.frame;
+		this->box_lock.store(&this->box, &last);
+	}
+	return done;
+}
+
+void *TldWorker::thread(void *arg) {
+	TldWorker *w = (TldWorker *)arg;
+	TldFrames *frames = w->frames;
+	pthread_mutex_lock(&frames->lock);
+	while (!w->quit) {
+		int have_frame = frames->latest_seq > w->last_seq &&
+				(w->running_type >= 0 || w->start_pending);
+		if (!have_frame && !w->stop_pending) {
+			pthread_cond_wait(&frames->data_ready, &frames->lock);
+			continue;
+		}
+		tld_frame *f = NULL;
+		int do_stop = w->stop_pending;
+		int do_start = 0;
+		ccv_rect_t start_box = w->start_box;
+		int start_type = w->start_type;
+		w->stop_pending = 0;
+		if (!do_stop) {
+			f = frames->acquire_latest();
+			w->last_seq = f->seq;
+			do_start = w->start_pending;
+			w->start_pending = 0;
+		}
+		pthread_mutex_unlock(&frames->lock);
+		tld_frame *done = w->process(f, do_start, do_stop, start_box, start_type);
+		pthread_mutex_lock(&frames->lock);
+		if (done) frames->release(done);
+	}
+	pthread_mutex_unlock(&frames->lock);
+	return NULL;
+}
@@ -0,0 +1,97 @@
+#if !defined (_TLD_WORKER_H)
+#define _TLD_WORKER_H (1)
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <ccv/ccv.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "luma_pyramid.h"
+#include "mosse.h"
+#include "seqlock.h"
+
+#define TRACKER_TLD 0
+#define TRACKER_MOSSE 1
+
+typedef struct tld_box {
+	ccv_rect_t rect;       // analysis level pixels
+	int found;
+	struct timespec ts;    // time of the frame the box was tracked in
+	uint64_t frame;
+} tld_box;
+
+typedef struct tld_frame {
+	uint8_t *data;
+	ccv_dense_matrix_t mat;  // header over data, built once
+	struct timespec ts;
+	uint64_t seq;
+	int refs;
+} tld_frame;
+
+/* Reference counted grayscale frames shared by every tracker, each
+ * wrapped in a ccv matrix header at init so tracking allocates nothing
+ * per frame. The newest published frame holds one reference of its
+ * own; each worker holds its current and previous frame, so publish()
+ * always finds a free frame as long as nframes is at least two per
+ * worker plus two. */
+class TldFrames {
+public:
+	TldFrames();
+	int init(int width, int height, int stride, int nframes);
+	void free();
+	void publish(const luma_image *l, const struct timespec *ts);
+	tld_frame *acquire_latest();
+	void release(tld_frame *f);
+	int width;
+	int height;
+	int stride;
+	uint64_t latest_seq;
+	pthread_mutex_t lock;
+	pthread_cond_t data_ready;
+private:
+	tld_frame *frames;
+	tld_frame *latest;
+	int nframes;
+	uint64_t next_seq;
+};
+
+/* Runs one TLD or MOSSE tracker on its own thread. The worker always
+ * takes the newest published frame, so a slow tracking step drops frames
+ * rather than stalling the caller, and read_box() returns the latest
+ * result without blocking. */
+class TldWorker {
+public:
+	TldWorker();
+	int init(TldFrames *frames);
+	void free();
+	void start(ccv_rect_t box, int type);
+	void stop();
+	void read_box(tld_box *out) const;
+	int tracking;
+private:
+	static void *thread(void *arg);
+	tld_frame *process(tld_frame *f, int do_start, int do_stop,
+					   ccv_rect_t start_box, int start_type);
+	TldFrames *frames;
+	pthread_t thread_id;
+	uint64_t last_seq;
+	int quit;
+	int start_pending;
+	int stop_pending;
+	ccv_rect_t start_box;
+	int start_type;
+	int running_type;      // worker side, -1 when idle
+	ccv_tld_t *tld;
+	MosseTracker mosse;
+	tld_frame *prev;
+	SeqLock box_lock;
+	tld_box box;
+};
+
+#endif
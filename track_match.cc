@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "track_match.h"
+
+int match_nearest(const match_point *olds, int nold, const match_point *news, int nnew,
+				  match_pair *pairs) {
+	struct candidate {
+		double d2;
+		int old_idx;
+		int new_idx;
+	};
+	std::vector<candidate> candidates;
+	std::vector<uint8_t> old_taken(nold, 0);
+	std::vector<uint8_t> new_taken(nnew, 0);
+	int npairs = 0;
+	for (int n = 0; n < nnew; n++) {
+		for (int o = 0; o < nold; o++) {
+			double dx = news[n].x - olds[o].x;
+			double dy = news[n].y - olds[o].y;
+			double d2 = dx * dx + dy * dy;
+			if (d2 <= olds[o].max_jump * olds[o].max_jump) candidates.push_back({ d2, o, n });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(),
+			  [](const candidate &a, const candidate &b) { return a.d2 < b.d2; });
+	for (size_t k = 0; k < candidates.size(); k++) {
+		candidate *c = &candidates[k];
+		if (old_taken[c->old_idx] || new_taken[c->new_idx]) continue;
+		old_taken[c->old_idx] = 1;
+		new_taken[c->new_idx] = 1;
+		pairs[npairs].old_idx = c->old_idx;
+		pairs[npairs].new_idx = c->new_idx;
+		npairs++;
+	}
+	return npairs;
+}
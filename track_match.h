@@ -0,0 +1,25 @@
+#if !defined (_TRACK_MATCH_H)
+#define _TRACK_MATCH_H (1)
+
+/* A centroid to match. max_jump is only read for old points: how far
+ * the new point matched to it may have moved. */
+struct match_point {
+	double x;
+	double y;
+	double max_jump;
+};
+
+struct match_pair {
+	int old_idx;
+	int new_idx;
+};
+
+/* Greedy nearest-centroid matching, shared by the blob tracker and the
+ * detector: the closest old/new pair within the old point's max_jump
+ * is matched first, then the next closest among the rest. Fills pairs,
+ * which must hold the smaller of nold and nnew, and returns how many
+ * there are. */
+int match_nearest(const match_point *olds, int nold, const match_point *news, int nnew,
+				  match_pair *pairs);
+
+#endif
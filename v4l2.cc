@@ -6,7 +6,7 @@
 #include "dingle_dots.h"
 #include "v4l2.h"
 
-V4l2::V4l2() { active = 0; allocated = 0; }
+V4l2::V4l2() { active = 0; allocated = 0; frame_ts.tv_sec = 0; frame_ts.tv_nsec = 0; }
 
 int V4l2::xioctl(int fh, int request, void *arg) {
 	int r;
@@ -48,6 +48,7 @@ void V4l2::create(DingleDots *dd, char *dev_name, double width, double height, u
 	this->allocated = 1;
 	this->pos.width = width;
 	this->pos.height = height;
+	this->data_ready.init();
 	pthread_create(&this->thread_id, NULL, V4l2::thread, this);
 
 }
@@ -67,9 +68,7 @@ void *V4l2::thread(void *arg) {
 	v->read_buf = (uint32_t *)(malloc(4 * v->pos.width * v->pos.height));
 	v->save_buf = (uint32_t *)(malloc(4 * v->pos.width * v->pos.height));
 	v->start_capturing();
-	pthread_mutex_lock(&v->lock);
 	v->read_frames();
-	pthread_mutex_unlock(&v->lock);
 	v->stop_capturing();
 	v->uninit_device();
 	v->close_device();
@@ -120,11 +119,16 @@ int V4l2::read_frames() {
 			this->save_buf[(int)this->pos.width - 1 - (i+1) + j*(int)this->pos.width] = 255 << 24 | r << 16 | g << 8 | b;
 		}
 		assert(buf.index < this->n_buffers);
-		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			ts.tv_sec = buf.timestamp.tv_sec;
+			ts.tv_nsec = buf.timestamp.tv_usec * 1000;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+		}
 		int space = 4 * this->pos.width * this->pos.height + sizeof(struct timespec);
 		int buf_space = jack_ringbuffer_write_space(this->rbuf);
 		while (buf_space < space) {
-			pthread_cond_wait(&this->data_ready, &this->lock);
+			this->data_ready.wait();
 			buf_space = jack_ringbuffer_write_space(this->rbuf);
 		}
 		jack_ringbuffer_write(this->rbuf, (const char *)&ts,
@@ -319,14 +323,12 @@ bool V4l2::render(std::vector<cairo_t *> &contexts) {
 		while (jack_ringbuffer_read_space(this->rbuf) >= space) {
 			ret = true;
 			jack_ringbuffer_read(this->rbuf, (char *)&ts, sizeof(struct timespec));
+			this->frame_ts = ts;
 			jack_ringbuffer_read(this->rbuf, (char *)this->read_buf, 4*this->pos.width*this->pos.height);
 			/*if (jack_ringbuffer_read_space(this->rbuf) >= space) {
 				gtk_widget_queue_draw(dingle_dots->drawing_area);
 			}*/
-			if (pthread_mutex_trylock(&this->lock) == 0) {
-				pthread_cond_signal(&this->data_ready);
-				pthread_mutex_unlock(&this->lock);
-			}
+			this->data_ready.notify();
 		}
 		cairo_surface_t *tsurf;
 		tsurf = cairo_image_surface_create_for_data(
@@ -21,6 +21,7 @@
 #include <gtk/gtk.h>
 
 #include "v4l2_wayland.h"
+#include "notifier.h"
 #include "drawable.h"
 
 
@@ -66,9 +67,9 @@ public:
 	uint32_t *read_buf;
 	struct pollfd pfd[1];
 	pthread_t thread_id;
-	pthread_mutex_t lock;
-	pthread_cond_t data_ready;
+	Notifier data_ready;
 	jack_ringbuffer_t *rbuf;
+	struct timespec frame_ts;
 	int activate();
 
 };
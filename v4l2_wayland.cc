@@ -22,7 +22,6 @@
 #include <jack/midiport.h>
 #include <linux/input.h>
 #include <cairo/cairo.h>
-#include <fftw3.h>
 #include <algorithm>
 #include <vector>
 #include <memory>
@@ -40,15 +39,14 @@
 #include "drawable.h"
 #include "video_file_source.h"
 #include "easable.h"
+#include "thread_pool.h"
+#include "fft_plans.h"
+#include "mixer.h"
+#include "yuv.h"
 
-fftw_complex                   *fftw_in, *fftw_out;
-fftw_plan                      p;
-static ccv_dense_matrix_t      *cdm = 0, *cdm2 = 0;
-static ccv_tld_t               *tld = 0;
 
 jack_ringbuffer_t        *video_ring_buf, *audio_ring_buf;
 const size_t              sample_size = sizeof(jack_default_audio_sample_t);
-pthread_mutex_t           av_thread_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void errno_exit(const char *s) {
 	fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
@@ -59,7 +57,6 @@ void *audio_disk_thread(void *arg) {
 	int ret;
 	DingleDots *dd = (DingleDots *)arg;
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_mutex_lock(&dd->audio_thread_info.lock);
 	while(1) {
 		ret = write_audio_frame(dd, dd->video_output_context, &dd->audio_thread_info.stream);
 		if (ret == 1) {
@@ -67,14 +64,9 @@ void *audio_disk_thread(void *arg) {
 			break;
 		}
 		if (ret == 0) continue;
-		if (ret == -1) pthread_cond_wait(&dd->audio_thread_info.data_ready,
-										 &dd->audio_thread_info.lock);
+		if (ret == -1) dd->audio_thread_info.data_ready.wait();
 	}
-	if (dd->audio_done && dd->video_done && !dd->trailer_written) {
-		av_write_trailer(dd->video_output_context);
-		dd->trailer_written = 1;
-	}
-	pthread_mutex_unlock(&dd->audio_thread_info.lock);
+	dd->muxer.finish(dd->audio_thread_info.stream.st->index);
 	return 0;
 }
 
@@ -82,7 +74,6 @@ void *video_disk_thread (void *arg) {
 	int ret;
 	DingleDots *dd = (DingleDots *)arg;
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_mutex_lock(&dd->video_thread_info.lock);
 	while(1) {
 		ret = write_video_frame(dd, dd->video_output_context,
 								&dd->video_thread_info.stream);
@@ -91,14 +82,9 @@ void *video_disk_thread (void *arg) {
 			break;
 		}
 		if (ret == 0) continue;
-		if (ret == -1) pthread_cond_wait(&dd->video_thread_info.data_ready,
-										 &dd->video_thread_info.lock);
-	}
-	if (dd->audio_done && dd->video_done && !dd->trailer_written) {
-		av_write_trailer(dd->video_output_context);
-		dd->trailer_written = 1;
+		if (ret == -1) dd->video_thread_info.data_ready.wait();
 	}
-	pthread_mutex_unlock(&dd->video_thread_info.lock);
+	dd->muxer.finish(dd->video_thread_info.stream.st->index);
 	printf("vid thread gets here\n");
 	return 0;
 }
@@ -129,69 +115,172 @@ int timespec2file_name(char *buf, uint len, const char *dir,
 }
 
 void *snapshot_disk_thread (void *arg) {
-	int fsize;
-	int tsize;
-	int space;
 	cairo_surface_t *csurf;
-	AVFrame *frame;
-	struct timespec ts;
+	recorded_frame rf;
 	char timestr[STR_LEN+1];
 	tzset();
 	DingleDots *dd = (DingleDots *)arg;
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_mutex_lock(&dd->snapshot_thread_info.lock);
-	frame = NULL;
-	frame = av_frame_alloc();
-	frame->width = dd->drawing_rect.width;
-	frame->height = dd->drawing_rect.height;
-	frame->format = AV_PIX_FMT_ARGB;
-	av_image_alloc(frame->data, frame->linesize,
-				   frame->width, frame->height, (AVPixelFormat)frame->format, 1);
-	if (!frame) {
-		fprintf(stderr, "Could not allocate temporary picture\n");
-		exit(1);
-	}
-
-	fsize = 4 * frame->width * frame->height;
-	tsize = fsize + sizeof(struct timespec);
-	csurf = cairo_image_surface_create_for_data((unsigned char *)frame->data[0],
-			CAIRO_FORMAT_ARGB32, frame->width, frame->height, 4*frame->width);
 	while(1) {
-		space = jack_ringbuffer_read_space(dd->snapshot_thread_info.ring_buf);
-		while (space >= tsize) {
-			jack_ringbuffer_read(dd->snapshot_thread_info.ring_buf, (char *)frame->data[0],
-					fsize);
-			jack_ringbuffer_read(dd->snapshot_thread_info.ring_buf, (char *)&ts,
-								 sizeof(ts));
-			timespec2file_name(timestr, STR_LEN, "Pictures", "png", &ts);
+		while (frame_queue_pop(dd->snapshot_thread_info.ring_buf, &rf)) {
+			csurf = cairo_image_surface_create_for_data(rf.frame->data[0],
+					CAIRO_FORMAT_ARGB32, rf.frame->width, rf.frame->height,
+					rf.frame->linesize[0]);
+			timespec2file_name(timestr, STR_LEN, "Pictures", "png", &rf.ts);
 			cairo_surface_write_to_png(csurf, timestr);
-			space = jack_ringbuffer_read_space(dd->snapshot_thread_info.ring_buf);
+			cairo_surface_destroy(csurf);
+			av_frame_free(&rf.frame);
 		}
-		pthread_cond_wait(&dd->snapshot_thread_info.data_ready,
-						  &dd->snapshot_thread_info.lock);
+		dd->snapshot_thread_info.data_ready.wait();
 	}
-	cairo_surface_destroy(csurf);
-	av_freep(frame->data[0]);
-	av_frame_free(&frame);
-	pthread_mutex_unlock(&dd->snapshot_thread_info.lock);
 	return 0;
 }
 
-ccv_tld_t *new_tld(int x, int y, int w, int h, DingleDots *dd) {
-	ccv_tld_param_t p = ccv_tld_default_params;
-	ccv_rect_t box = ccv_rect(x, y, w, h);
-	ccv_read(dd->analysis_frame->data[0], &cdm, CCV_IO_ARGB_RAW | CCV_IO_GRAY,
-			dd->analysis_rect.height, dd->analysis_rect.width, 4*dd->analysis_rect.width);
-	return ccv_tld_new(cdm, box, p);
+/* Start a tracker on user_tld_rect in a free slot, or in place of the
+ * oldest one if all are busy. It drives the selected shapes, or every
+ * shape if none are selected. */
+static void start_tld_tracker(DingleDots *dd) {
+	tld_tracker *tr = NULL;
+	int any_selected = 0;
+	for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+		if (!dd->tld_trackers[t].worker.tracking) {
+			tr = &dd->tld_trackers[t];
+			break;
+		}
+	}
+	if (!tr) {
+		tr = &dd->tld_trackers[dd->next_tld_tracker];
+		dd->next_tld_tracker = (dd->next_tld_tracker + 1) % MAX_NUM_TLD_TRACKERS;
+	}
+	for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+		if (dd->sound_shapes[i].active && dd->sound_shapes[i].selected) any_selected = 1;
+	}
+	for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+		tr->targets[i] = any_selected ? dd->sound_shapes[i].active &&
+										dd->sound_shapes[i].selected : 1;
+	}
+	tr->box_color = dd->random_color();
+	tr->worker.start(ccv_rect(dd->user_tld_rect.x/dd->ascale_factor_x,
+							  dd->user_tld_rect.y/dd->ascale_factor_y,
+							  dd->user_tld_rect.width/dd->ascale_factor_x,
+							  dd->user_tld_rect.height/dd->ascale_factor_y),
+					 dd->tracker_type);
+}
+
+/* Spawn a shape for a detection with the note and channel currently
+ * chosen in the control window. */
+static void spawn_detection_shape(DingleDots *dd, detection *d,
+								  double sx, double sy) {
+	char scale_name[] = "DETECT";
+	color c = dd->random_color();
+	const gchar *note_id = gtk_combo_box_get_active_id(GTK_COMBO_BOX(dd->note_combo));
+	if (!note_id) return;
+	gchar *channel_text = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(dd->channel_combo));
+	int note = atoi(note_id);
+	int channel = channel_text ? atoi(channel_text) : 0;
+	g_free(channel_text);
+	int slot = dd->add_note(scale_name, 0, note, channel,
+							sx * (d->rect.x + 0.5 * d->rect.width),
+							sy * (d->rect.y + 0.5 * d->rect.height),
+							0.5 * std::max(sx * d->rect.width, sy * d->rect.height), &c);
+	if (slot >= 0) dd->sound_shapes[slot].detection_id = d->id;
+}
+
+/* Publish a frame to the detector every DETECT_INTERVAL and keep the
+ * shapes attached to its detections: each shape eases toward its
+ * detection every frame, is on while the detection was found in the
+ * last run, and goes away when the detection is dropped. */
+static void update_detections(DingleDots *dd, struct timespec *ts) {
+	luma_image *l = dd->pyramid.level(dd->detect_level);
+	double sx = dd->drawing_rect.width / (double)l->width;
+	double sy = dd->drawing_rect.height / (double)l->height;
+	double now = timespec_to_seconds(ts);
+	uint8_t attached[MAX_NUM_DETECTIONS] = { 0 };
+	detection_set ds;
+	if (now >= dd->next_detect_ts) {
+		dd->detect_frames.publish(l, ts);
+		dd->next_detect_ts = now + DETECT_INTERVAL;
+	}
+	dd->detector.read(&ds);
+	for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+		SoundShape *s = &dd->sound_shapes[i];
+		if (!s->active || s->detection_id < 0) continue;
+		detection *d = NULL;
+		for (int k = 0; k < ds.n; k++) {
+			if (ds.d[k].id == s->detection_id) {
+				d = &ds.d[k];
+				attached[k] = 1;
+				break;
+			}
+		}
+		if (!d) {
+			s->detection_id = -1;
+			s->detect_state = 0;
+			s->deactivate();
+			continue;
+		}
+		s->pos.x += DETECT_FOLLOW * (sx * (d->rect.x + 0.5 * d->rect.width) - s->pos.x);
+		s->pos.y += DETECT_FOLLOW * (sy * (d->rect.y + 0.5 * d->rect.height) - s->pos.y);
+		s->detect_state = d->misses == 0;
+	}
+	if (ds.run == dd->detect_run) return;
+	dd->detect_run = ds.run;
+	for (int k = 0; k < ds.n; k++) {
+		if (attached[k] || ds.d[k].misses || ds.d[k].age < DETECT_MIN_AGE) continue;
+		spawn_detection_shape(dd, &ds.d[k], sx, sy);
+	}
+}
+
+/* Stop every tracker whose box contains (x, y), or all of them if none
+ * does. */
+static void stop_tld_trackers(DingleDots *dd, double x, double y) {
+	int stopped = 0;
+	for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+		tld_tracker *tr = &dd->tld_trackers[t];
+		tld_box box;
+		if (!tr->worker.tracking) continue;
+		tr->worker.read_box(&box);
+		if (x >= dd->ascale_factor_x * box.rect.x &&
+				x <= dd->ascale_factor_x * (box.rect.x + box.rect.width) &&
+				y >= dd->ascale_factor_y * box.rect.y &&
+				y <= dd->ascale_factor_y * (box.rect.y + box.rect.height)) {
+			tr->worker.stop();
+			stopped = 1;
+		}
+	}
+	if (stopped) return;
+	for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+		dd->tld_trackers[t].worker.stop();
+	}
+}
+
+static void render_blobs(cairo_t *cr, BlobTracker *bt) {
+	cairo_save(cr);
+	cairo_set_line_width(cr, 2.0);
+	for (int b = 0; b < bt->nblobs; b++) {
+		blob *bl = &bt->blobs[b];
+		if (bl->age < BLOB_MIN_AGE) continue;
+		cairo_set_source_rgba(cr, 0.85, 0.85, 0., 0.75);
+		cairo_new_sub_path(cr);
+		cairo_arc(cr, bl->x, bl->y, bl->r, 0, 2 * M_PI);
+		cairo_stroke(cr);
+		cairo_move_to(cr, bl->x - 4, bl->y);
+		cairo_line_to(cr, bl->x + 4, bl->y);
+		cairo_move_to(cr, bl->x, bl->y - 4);
+		cairo_line_to(cr, bl->x, bl->y + 4);
+		cairo_stroke(cr);
+	}
+	cairo_restore(cr);
 }
 
-static void render_detection_box(cairo_t *cr, int initializing,
+static void render_detection_box(cairo_t *cr, int initializing, color *c,
 								 int x, int y, int w, int h) {
 	double minimum = vw_min(w, h);
 	double r = 0.05 * minimum;
 	cairo_save(cr);
 	//cairo_new_sub_path(cr);
 	if (initializing) cairo_set_source_rgba(cr, 0.85, 0.85, 0., 0.75);
+	else if (c) cairo_set_source_rgba(cr, c->r, c->g, c->b, 0.75);
 	else cairo_set_source_rgba(cr, 0.2, 0., 0.2, 0.75);
 	cairo_arc(cr, x + r, y + r, r, M_PI, 1.5 * M_PI);
 	cairo_stroke(cr);
@@ -275,68 +364,240 @@ void get_sources(DingleDots *dd, std::vector<Drawable *> &sources)
 	}
 }
 
-double calculate_motion(SoundShape *ss, AVFrame *sources_frame, uint32_t *save_buf_sources,
-						double width, double height)
+/* Mean squared luma difference over the shape, measured on the
+ * coarsest pyramid level that still covers it with
+ * pyramid->min_level_radius pixels. Box filtering shrinks the
+ * difference a small movement makes by roughly half per level, so the
+ * score is scaled back up by scale^MOTION_LEVEL_EXPONENT; that puts
+ * motion_threshold at the same displacement, within a fraction of a
+ * pixel, as the old full resolution measure on textured scenes. */
+double calculate_motion(SoundShape *ss, LumaPyramid *pyramid)
 {
 	int i;
 	int j;
-	double fb;
 	int iend;
 	int jend;
-	double fg;
-	double fr;
 	int jstart;
 	int istart;
-	double bw;
-	double bw2;
-	double diff;
-	uint32_t val;
-	double sum;
+	int diff;
+	uint64_t sum;
 	uint32_t npts;
+	double r = ss->r * ss->scale;
+	int n = pyramid->level_for_radius(r);
+	double scale = pyramid->scale(n);
+	const luma_image *cur = pyramid->level(n);
+	const luma_image *prev = pyramid->prev_level(n);
 
 	sum = 0;
 	npts = 0;
-	istart = vw_min(width, vw_max(0, round(ss->pos.x -
-													ss->r * ss->scale)));
-	jstart = vw_min(height, vw_max(0, round(ss->pos.y -
-													   ss->r * ss->scale)));
-	iend = vw_max(istart, vw_min(width, round(ss->pos.x +
-													ss->r * ss->scale)));
-	jend = vw_max(jstart, vw_min(height, round(ss->pos.y +
-													 ss->r* ss->scale)));
-	for (i = istart; i < iend; i++) {
-		for (j = jstart; j < jend; j++) {
-			if (ss->in(i, j)) {
-				val = save_buf_sources[i + j * sources_frame->width];
-				fr = ((val & 0x00ff0000) >> 16) / 256.;
-				fg = ((val & 0x0000ff00) >> 8) / 256.;
-				fb = ((val & 0x000000ff)) / 256.;
-				bw = fr * 0.3 + fg * 0.59 + fb * 0.1;
-				val = ((uint32_t *)sources_frame->data[0])[i + j * sources_frame->width];
-				fr = ((val & 0x00ff0000) >> 16) / 256.;
-				fg = ((val & 0x0000ff00) >> 8) / 256.;
-				fb = ((val & 0x000000ff)) / 256.;
-				bw2 = fr * 0.3 + fg * 0.59 + fb * 0.1;
-				diff = bw - bw2;
+	istart = vw_min(cur->width, vw_max(0, round((ss->pos.x - r) / scale)));
+	jstart = vw_min(cur->height, vw_max(0, round((ss->pos.y - r) / scale)));
+	iend = vw_max(istart, vw_min(cur->width, round((ss->pos.x + r) / scale)));
+	jend = vw_max(jstart, vw_min(cur->height, round((ss->pos.y + r) / scale)));
+	for (j = jstart; j < jend; j++) {
+		const uint8_t *c = cur->data + j * cur->stride;
+		const uint8_t *p = prev->data + j * prev->stride;
+		for (i = istart; i < iend; i++) {
+			if (ss->in((i + 0.5) * scale, (j + 0.5) * scale)) {
+				diff = c[i] - p[i];
 				sum += diff * diff;
 				npts++;
 			}
 		}
 	}
-	return sum / npts;
+	if (!npts) return 0;
+	return pow(scale, MOTION_LEVEL_EXPONENT) * sum / (65536.0 * npts);
+}
+
+static void motion_chunk(int task, void *arg)
+{
+	motion_job *job = (motion_job *)arg;
+	int start = task * job->chunk;
+	int end = vw_min(job->nshapes, start + job->chunk);
+	for (int k = start; k < end; k++) {
+		SoundShape *s = job->shapes[k];
+		if (job->diffs) {
+			job->diffs[k] = calculate_motion(s, job->pyramid);
+		}
+		if (job->flows) {
+			job->flow->estimate(s->pos.x, s->pos.y, s->r * s->scale, &job->flows[k]);
+		}
+	}
+}
+
+/* Split the shapes into chunks across the pool. Each shape's result
+ * lands in its own slot, so the caller sees the same results in the
+ * same order no matter how the chunks were scheduled. */
+void evaluate_motion(ThreadPool *pool, motion_job *job)
+{
+	int nchunks = vw_min(job->nshapes, 4 * pool->get_nthreads());
+	if (nchunks == 0) return;
+	job->chunk = (job->nshapes + nchunks - 1) / nchunks;
+	nchunks = (job->nshapes + job->chunk - 1) / job->chunk;
+	pool->parallel_for(nchunks, motion_chunk, job);
+}
+
+void apply_flow(DingleDots *dd, SoundShape *ss, flow_vector *v)
+{
+	uint8_t value;
+	ss->motion_speed = v->magnitude;
+	if (!v->nmoving) return;
+	ss->motion_direction = v->direction;
+	ss->velocity = flow_speed_to_velocity(v->magnitude, dd->flow_full_scale_speed);
+	if (!ss->on) return;
+	if (dd->flow_speed_cc >= 0) {
+		value = ss->velocity - 1;
+		if (value != ss->speed_cc_value &&
+				midi_queue_new_message(0xB0 | ss->midi_channel, dd->flow_speed_cc,
+									   value, dd)) {
+			ss->speed_cc_value = value;
+		}
+	}
+	if (dd->flow_direction_cc >= 0) {
+		value = flow_direction_to_cc(v->direction);
+		if (value != ss->direction_cc_value &&
+				midi_queue_new_message(0xB0 | ss->midi_channel, dd->flow_direction_cc,
+									   value, dd)) {
+			ss->direction_cc_value = value;
+		}
+	}
+}
+
+void bench_motion(int width, int height, double min_level_radius)
+{
+	int nshapes = MAX_NUM_SOUND_SHAPES;
+	int niter = 10;
+	double base_ms = 0;
+	SoundShape *shapes = new SoundShape[nshapes];
+	std::vector<SoundShape *> list;
+	std::vector<double> diffs(nshapes);
+	AVFrame *frame = av_frame_alloc();
+	frame->format = AV_PIX_FMT_ARGB;
+	frame->width = width;
+	frame->height = height;
+	if (av_image_alloc(frame->data, frame->linesize, width, height,
+					   (AVPixelFormat)frame->format, 1) < 0) {
+		fprintf(stderr, "Could not allocate benchmark frame\n");
+		exit(1);
+	}
+	LumaPyramid pyramid;
+	pyramid.init(width, height);
+	pyramid.min_level_radius = min_level_radius;
+	for (int f = 0; f < 2; f++) {
+		for (int i = 0; i < width * height; i++) {
+			((uint32_t *)frame->data[0])[i] = rand();
+		}
+		pyramid.build((uint32_t *)frame->data[0], frame->linesize[0]);
+	}
+	for (int k = 0; k < nshapes; k++) {
+		shapes[k].pos.x = (1.0 * rand()) / RAND_MAX * width;
+		shapes[k].pos.y = (1.0 * rand()) / RAND_MAX * height;
+		shapes[k].r = width / 16.;
+		shapes[k].scale = 1.0;
+		list.push_back(&shapes[k]);
+	}
+	motion_job job;
+	job.shapes = list.data();
+	job.nshapes = nshapes;
+	job.pyramid = &pyramid;
+	job.diffs = diffs.data();
+	job.flow = NULL;
+	job.flows = NULL;
+	printf("motion benchmark: %d shapes of radius %.0f over %dx%d, level %d\n",
+		   nshapes, width / 16., width, height, pyramid.level_for_radius(width / 16.));
+	for (int n = 1; n <= ThreadPool::default_nthreads(); n++) {
+		ThreadPool pool;
+		struct timespec start_ts, end_ts, diff_ts;
+		pool.init(n);
+		clock_gettime(CLOCK_MONOTONIC, &start_ts);
+		for (int i = 0; i < niter; i++) {
+			evaluate_motion(&pool, &job);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_ts);
+		pool.free();
+		timespec_diff(&start_ts, &end_ts, &diff_ts);
+		double ms = timespec_to_seconds(&diff_ts) * 1000 / niter;
+		if (n == 1) base_ms = ms;
+		printf("threads: %2d  %8.2f ms/frame  speedup %.2f\n", n, ms, base_ms / ms);
+	}
+	pyramid.free();
+	av_freep(&frame->data[0]);
+	av_frame_free(&frame);
+	delete[] shapes;
+}
+
+/* Time the recorder's BGRA to YUV420P conversion: the sws_scale call
+ * it used to make, then bgra_to_i420() on 1..N threads. */
+void bench_yuv(int width, int height)
+{
+	int niter = 50;
+	double sws_ms;
+	AVFrame *src = av_frame_alloc();
+	AVFrame *dst = av_frame_alloc();
+	src->format = AV_PIX_FMT_BGRA;
+	dst->format = AV_PIX_FMT_YUV420P;
+	if (av_image_alloc(src->data, src->linesize, width, height,
+					   (AVPixelFormat)src->format, 32) < 0 ||
+			av_image_alloc(dst->data, dst->linesize, width, height,
+						   (AVPixelFormat)dst->format, 1) < 0) {
+		fprintf(stderr, "Could not allocate benchmark frame\n");
+		exit(1);
+	}
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			((uint32_t *)(src->data[0] + j * src->linesize[0]))[i] = rand();
+		}
+	}
+	struct SwsContext *sws = sws_getContext(width, height, AV_PIX_FMT_BGRA,
+											width, height, AV_PIX_FMT_YUV420P,
+											SWS_BICUBIC, NULL, NULL, NULL);
+	if (!sws) {
+		fprintf(stderr, "Could not initialize the conversion context\n");
+		exit(1);
+	}
+	struct timespec start_ts, end_ts, diff_ts;
+	printf("yuv benchmark: BGRA to YUV420P at %dx%d\n", width, height);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	for (int i = 0; i < niter; i++) {
+		sws_scale(sws, (const uint8_t * const *)src->data, src->linesize, 0,
+				  height, dst->data, dst->linesize);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_ts);
+	timespec_diff(&start_ts, &end_ts, &diff_ts);
+	sws_ms = timespec_to_seconds(&diff_ts) * 1000 / niter;
+	printf("sws_scale:   %8.2f ms/frame\n", sws_ms);
+	sws_freeContext(sws);
+	for (int n = 1; n <= ThreadPool::default_nthreads(); n++) {
+		ThreadPool pool;
+		pool.init(n);
+		clock_gettime(CLOCK_MONOTONIC, &start_ts);
+		for (int i = 0; i < niter; i++) {
+			bgra_to_i420(&pool, src->data[0], src->linesize[0], dst->data,
+						 dst->linesize, width, height);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_ts);
+		pool.free();
+		timespec_diff(&start_ts, &end_ts, &diff_ts);
+		double ms = timespec_to_seconds(&diff_ts) * 1000 / niter;
+		printf("threads: %2d  %8.2f ms/frame  speedup %.2f\n", n, ms, sws_ms / ms);
+	}
+	av_freep(&src->data[0]);
+	av_freep(&dst->data[0]);
+	av_frame_free(&src);
+	av_frame_free(&dst);
 }
 
 void set_to_on_or_off(SoundShape *ss, GtkWidget *da)
 {
 	if (ss->double_clicked_on || ss->motion_state
-			|| ss->tld_state) {
+			|| ss->tld_state || ss->blob_state || ss->detect_state) {
 		if (!ss->on) {
 			ss->set_on();
 			gtk_widget_queue_draw(da);
 		}
 	}
 	if (!ss->double_clicked_on && !ss->motion_state
-			&& !ss->tld_state) {
+			&& !ss->tld_state && !ss->blob_state && !ss->detect_state) {
 		if (ss->on) {
 			ss->set_off();
 			gtk_widget_queue_draw(da);
@@ -344,39 +605,59 @@ void set_to_on_or_off(SoundShape *ss, GtkWidget *da)
 	}
 }
 
+/* Beats from the tracker pulse the sound shapes and take snapshots,
+ * as the command line asked. */
+static void handle_beats(DingleDots *dd) {
+	beat_event ev;
+	while (dd->beats.read_event(&ev)) {
+		if (ev.type != BEAT_BEAT) continue;
+		if (dd->beat_pulse) {
+			for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+				if (dd->sound_shapes[i].active) {
+					dd->sound_shapes[i].pulse(BEAT_PULSE_SCALE, BEAT_PULSE_SECS);
+				}
+			}
+		}
+		if (dd->beat_snapshot) {
+			dd->do_snapshot = 1;
+		}
+	}
+}
+
 void process_image(cairo_t *screen_cr, void *arg) {
 	DingleDots *dd = (DingleDots *)arg;
 	static int first_call = 1;
 	static int first_data = 1;
 	static struct timespec ts, snapshot_ts;
-	static ccv_comp_t newbox;
-	static int made_first_tld = 0;
+	tld_box boxes[MAX_NUM_TLD_TRACKERS];
+	memset(boxes, 0, sizeof(boxes));
 	std::vector<Drawable *> sources;
-	int s, i;
+	int i;
 	double diff;
-	static uint32_t *save_buf_sources;
 	int render_drawing_surf = 0;
 	cairo_t *sources_cr;
 	cairo_surface_t *sources_surf;
 	cairo_t *drawing_cr;
 	cairo_surface_t *drawing_surf;
+	AVFrame *drawing;
+	AVFrame *recorded = NULL;
 	struct timespec start_ts, end_ts;
 	clock_gettime(CLOCK_MONOTONIC, &start_ts);
-	if (first_data) {
-		save_buf_sources = (uint32_t *)malloc(dd->sources_frame->linesize[0] * dd->sources_frame->height);
+	/* A frame that will be recorded is drawn straight into a pool
+	 * frame, which the disk threads take references to; otherwise the
+	 * layer goes to the scratch drawing_frame. */
+	if (dd->do_snapshot || (dd->recording_started && !dd->recording_stopped)) {
+		recorded = dd->frame_pool.get();
 	}
+	drawing = recorded ? recorded : dd->drawing_frame;
 	sources_surf = cairo_image_surface_create_for_data((unsigned char *)dd->sources_frame->data[0],
 			CAIRO_FORMAT_ARGB32, dd->sources_frame->width, dd->sources_frame->height,
 			dd->sources_frame->linesize[0]);
 	sources_cr = cairo_create(sources_surf);
-	drawing_surf = cairo_image_surface_create_for_data((unsigned char *)dd->drawing_frame->data[0],
-			CAIRO_FORMAT_ARGB32, dd->drawing_frame->width, dd->drawing_frame->height,
-			dd->drawing_frame->linesize[0]);
+	drawing_surf = cairo_image_surface_create_for_data((unsigned char *)drawing->data[0],
+			CAIRO_FORMAT_ARGB32, drawing->width, drawing->height,
+			drawing->linesize[0]);
 	drawing_cr = cairo_create(drawing_surf);
-	if (!first_data && (dd->doing_motion || dd->snapshot_shape.active)) {
-		memcpy(save_buf_sources, dd->sources_frame->data[0], 4 * dd->sources_frame->width *
-				dd->sources_frame->height);
-	}
 	clear(sources_cr);
 	get_sources(dd, sources);
 	std::sort(sources.begin(), sources.end(), [](Drawable *a, Drawable *b) { return a->z < b->z; } );
@@ -389,7 +670,30 @@ void process_image(cairo_t *screen_cr, void *arg) {
 		(*it)->update_easers();
 		(*it)->render(contexts);
 	}
-	if (dd->doing_motion) {
+	/* Notes this frame triggers are timed from when the newest camera
+	 * frame was captured, not from when GTK got around to drawing it. */
+	struct timespec *event_ts = NULL;
+	for (i = 0; i < MAX_NUM_V4L2; i++) {
+		V4l2 *v = &dd->v4l2[i];
+		if (!v->active || !v->frame_ts.tv_sec) continue;
+		if (!event_ts || timespec_to_seconds(&v->frame_ts) > timespec_to_seconds(event_ts)) {
+			event_ts = &v->frame_ts;
+		}
+	}
+	midi_set_event_time(dd, event_ts);
+	handle_beats(dd);
+	if (dd->doing_motion || dd->doing_flow || dd->doing_tld ||
+			dd->doing_blobs || dd->doing_detect || dd->snapshot_shape.active) {
+		dd->pyramid.build((uint32_t *)dd->sources_frame->data[0],
+						  dd->sources_frame->linesize[0]);
+	} else {
+		dd->pyramid.reset();
+	}
+	for (i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
+		dd->motion_engine.active[i] = dd->sound_shapes[i].active;
+		dd->motion_engine.score[i] = 0;
+	}
+	if (dd->doing_motion || dd->doing_flow) {
 		std::vector<SoundShape *> sound_shapes;
 		for (i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
 			SoundShape *s = &dd->sound_shapes[i];
@@ -397,25 +701,51 @@ void process_image(cairo_t *screen_cr, void *arg) {
 				sound_shapes.push_back(s);
 			}
 		}
-		for (std::vector<SoundShape *>::iterator it = sound_shapes.begin(); it != sound_shapes.end(); ++it) {
-			SoundShape *s = *it;
-			diff = calculate_motion(s, dd->sources_frame, save_buf_sources,
-										   dd->drawing_rect.width, dd->drawing_rect.height);
-			if (diff > dd->motion_threshold) {
-				s->set_motion_state(1);
-			} else {
-				s->set_motion_state(0);
+		int n = sound_shapes.size();
+		std::vector<double> diffs(n);
+		std::vector<flow_vector> flows(n);
+		motion_job job;
+		job.shapes = sound_shapes.data();
+		job.nshapes = n;
+		job.pyramid = &dd->pyramid;
+		job.diffs = dd->doing_motion ? diffs.data() : NULL;
+		job.flow = &dd->flow;
+		job.flows = dd->doing_flow ? flows.data() : NULL;
+		evaluate_motion(&dd->thread_pool, &job);
+		for (int k = 0; k < n; k++) {
+			if (dd->doing_flow) {
+				apply_flow(dd, sound_shapes[k], &flows[k]);
+			}
+			if (dd->doing_motion) {
+				dd->motion_engine.score[sound_shapes[k] - dd->sound_shapes] = diffs[k];
 			}
 		}
-	} else {
-		for (s = 0; s < MAX_NUM_SOUND_SHAPES; s++) {
-			dd->sound_shapes[s].set_motion_state(0);
+	}
+	dd->motion_engine.update(timespec_to_seconds(&start_ts));
+	for (int c = 0; c < dd->motion_engine.nchanged; c++) {
+		int slot = dd->motion_engine.changed[c];
+		dd->sound_shapes[slot].motion_state = dd->motion_engine.state[slot];
+	}
+	if (dd->doing_blobs) {
+		dd->blob_tracker.update();
+		for (i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+			SoundShape *s = &dd->sound_shapes[i];
+			if (!s->active) continue;
+			s->blob_state = 0;
+			for (int b = 0; b < dd->blob_tracker.nblobs; b++) {
+				blob *bl = &dd->blob_tracker.blobs[b];
+				if (bl->age >= BLOB_MIN_AGE && s->in(bl->x, bl->y)) {
+					s->blob_state = 1;
+					break;
+				}
+			}
 		}
 	}
+	if (dd->doing_detect) {
+		update_detections(dd, &start_ts);
+	}
 	if (dd->snapshot_shape.active) {
-		diff= calculate_motion(&dd->snapshot_shape, dd->sources_frame,
-							   save_buf_sources, dd->drawing_rect.width,
-							   dd->drawing_rect.height);
+		diff = calculate_motion(&dd->snapshot_shape, &dd->pyramid);
 		if (diff >= dd->motion_threshold) {
 			dd->snapshot_shape.set_motion_state(1);
 		} else {
@@ -436,58 +766,50 @@ void process_image(cairo_t *screen_cr, void *arg) {
 	if (first_data) {
 		first_data = 0;
 	}
+	if (dd->make_new_tld == 1) {
+		if (dd->user_tld_rect.width > 0 && dd->user_tld_rect.height > 0) {
+			start_tld_tracker(dd);
+		}
+		dd->make_new_tld = 0;
+	}
+	dd->doing_tld = 0;
+	for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+		if (dd->tld_trackers[t].worker.tracking) dd->doing_tld = 1;
+	}
+	for (i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+		dd->sound_shapes[i].tld_state = 0;
+	}
 	if (dd->doing_tld) {
-		sws_scale(dd->analysis_resize, (uint8_t const * const *)dd->sources_frame->data,
-				  dd->sources_frame->linesize, 0, dd->sources_frame->height, dd->analysis_frame->data, dd->analysis_frame->linesize);
-		if (dd->make_new_tld == 1) {
-			if (dd->user_tld_rect.width > 0 && dd->user_tld_rect.height > 0) {
-				tld = new_tld(dd->user_tld_rect.x/dd->ascale_factor_x, dd->user_tld_rect.y/dd->ascale_factor_y,
-							  dd->user_tld_rect.width/dd->ascale_factor_x, dd->user_tld_rect.height/dd->ascale_factor_y, dd);
-			} else {
-				tld = NULL;
-				dd->doing_tld = 0;
-				made_first_tld = 0;
-				newbox.rect.x = 0;
-				newbox.rect.y = 0;
-				newbox.rect.width = 0;
-				newbox.rect.height = 0;
-			}
-			made_first_tld = 1;
-			dd->make_new_tld = 0;
-		} else {
-			ccv_read(dd->analysis_frame->data[0], &cdm2, CCV_IO_ABGR_RAW |
-					CCV_IO_GRAY, dd->analysis_rect.height, dd->analysis_rect.width, 4*dd->analysis_rect.width);
-			ccv_tld_info_t info;
-			newbox = ccv_tld_track_object(tld, cdm, cdm2, &info);
-			cdm = cdm2;
-			cdm2 = 0;
-		}
-		if (newbox.rect.width && newbox.rect.height &&
-				made_first_tld && tld->found) {
+		dd->tld_frames.publish(dd->pyramid.level(dd->tld_level), &start_ts);
+		for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+			tld_tracker *tr = &dd->tld_trackers[t];
+			if (!tr->worker.tracking) continue;
+			tr->worker.read_box(&boxes[t]);
+			if (!boxes[t].found) continue;
 			for (i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
-				if (!dd->sound_shapes[i].active) continue;
-				if (dd->sound_shapes[i].in(dd->ascale_factor_x*newbox.rect.x +
-										   0.5*dd->ascale_factor_x*newbox.rect.width,
-										   dd->ascale_factor_y*newbox.rect.y +
-										   0.5*dd->ascale_factor_y*newbox.rect.height)) {
+				if (!dd->sound_shapes[i].active || !tr->targets[i]) continue;
+				if (dd->sound_shapes[i].in(dd->ascale_factor_x*boxes[t].rect.x +
+										   0.5*dd->ascale_factor_x*boxes[t].rect.width,
+										   dd->ascale_factor_y*boxes[t].rect.y +
+										   0.5*dd->ascale_factor_y*boxes[t].rect.height)) {
 					dd->sound_shapes[i].tld_state = 1;
-				} else {
-					dd->sound_shapes[i].tld_state = 0;
 				}
 			}
 		}
-	} else {
-		tld = NULL;
-		made_first_tld = 0;
-		newbox.rect.x = 0;
-		newbox.rect.y = 0;
-		newbox.rect.width = 0;
-		newbox.rect.height = 0;
 	}
 	for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
 		if (!dd->sound_shapes[i].active) continue;
 		set_to_on_or_off(&dd->sound_shapes[i], dd->drawing_area);
 	}
+	if (dd->doing_motion && (dd->motion_cc >= 0 || dd->motion_bend || dd->motion_pressure)) {
+		for (i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+			SoundShape *s = &dd->sound_shapes[i];
+			if (!s->active) continue;
+			midi_send_motion(dd, s, s->on ? dd->motion_engine.score[i] : 0);
+		}
+	}
+	midi_set_event_time(dd, NULL);
+	midi_flush_note_offs(dd);
 	std::vector<Drawable *> sound_shapes;
 	std::vector<cairo_t *> ss_contexts;
 	ss_contexts.push_back(screen_cr);
@@ -512,25 +834,28 @@ void process_image(cairo_t *screen_cr, void *arg) {
 	}
 
 #if defined(RENDER_KMETERS)
-	for (i = 0; i < 2; i++) {
+	for (i = 0; i < dd->ninputs; i++) {
 		kmeter_render(&dd->meters[i], drawing_cr, 1.);
 		kmeter_render(&dd->meters[i], screen_cr, 1.);
 	}
 #endif
 #if defined(RENDER_FFT)
+	static std::vector<float> mags;
 	double space;
 	double w;
 	double h;
 	double x;
-	w = dd->drawing_rect.width / (FFT_SIZE + 1);
+	mags.resize(dd->spectrum.nbins);
+	dd->spectrum.read(mags.data());
+	w = dd->drawing_rect.width / (2.0 * dd->spectrum.nbins + 1);
 	space = w;
 	cairo_save(drawing_cr);
 	cairo_save(screen_cr);
 	cairo_set_source_rgba(drawing_cr, 0, 0.25, 0, 0.5);
 	cairo_set_source_rgba(screen_cr, 0, 0.25, 0, 0.5);
-	for (i = 0; i < FFT_SIZE/2; i++) {
-		h = ((20.0 * log(sqrt(fftw_out[i][0] * fftw_out[i][0] +
-			  fftw_out[i][1] * fftw_out[i][1])) / M_LN10) + 50.) * (dd->drawing_rect.height / 50.);
+	for (i = 0; i < dd->spectrum.nbins; i++) {
+		h = (20.0 * log10(mags[i] + 1e-9) / SPECTRUM_RANGE_DB + 1.) * dd->drawing_rect.height;
+		if (h <= 0) continue;
 		x = i * (w + space) + space;
 		cairo_rectangle(drawing_cr, x, dd->drawing_rect.height - h, w, h);
 		cairo_rectangle(screen_cr, x, dd->drawing_rect.height - h, w, h);
@@ -542,10 +867,10 @@ void process_image(cairo_t *screen_cr, void *arg) {
 #endif
 	if (dd->smdown) {
 		if (render_drawing_surf) {
-			render_detection_box(drawing_cr, 1, dd->user_tld_rect.x, dd->user_tld_rect.y,
+			render_detection_box(drawing_cr, 1, NULL, dd->user_tld_rect.x, dd->user_tld_rect.y,
 								 dd->user_tld_rect.width, dd->user_tld_rect.height);
 		}
-		render_detection_box(screen_cr, 1, dd->user_tld_rect.x, dd->user_tld_rect.y,
+		render_detection_box(screen_cr, 1, NULL, dd->user_tld_rect.x, dd->user_tld_rect.y,
 							 dd->user_tld_rect.width, dd->user_tld_rect.height);
 	}
 	if (dd->selection_in_progress) {
@@ -578,38 +903,42 @@ void process_image(cairo_t *screen_cr, void *arg) {
 		//gtk_widget_draw(GTK_WIDGET(dd->ctl_window), drawing_cr);
 	}
 	render_pointer(screen_cr, dd->scale * dd->mouse_pos.x, dd->scale * dd->mouse_pos.y);
-	if (dd->doing_tld) {
+	for (int t = 0; t < MAX_NUM_TLD_TRACKERS; t++) {
+		if (!boxes[t].found) continue;
+		color *c = &dd->tld_trackers[t].box_color;
 		if (render_drawing_surf) {
-			render_detection_box(drawing_cr, 0, dd->ascale_factor_x*newbox.rect.x,
-								 dd->ascale_factor_y*newbox.rect.y, dd->ascale_factor_x*newbox.rect.width,
-								 dd->ascale_factor_y*newbox.rect.height);
+			render_detection_box(drawing_cr, 0, c, dd->ascale_factor_x*boxes[t].rect.x,
+								 dd->ascale_factor_y*boxes[t].rect.y, dd->ascale_factor_x*boxes[t].rect.width,
+								 dd->ascale_factor_y*boxes[t].rect.height);
 		}
-		render_detection_box(screen_cr, 0, dd->ascale_factor_x*newbox.rect.x,
-							 dd->ascale_factor_y*newbox.rect.y, dd->ascale_factor_x*newbox.rect.width,
-							 dd->ascale_factor_y*newbox.rect.height);
+		render_detection_box(screen_cr, 0, c, dd->ascale_factor_x*boxes[t].rect.x,
+							 dd->ascale_factor_y*boxes[t].rect.y, dd->ascale_factor_x*boxes[t].rect.width,
+							 dd->ascale_factor_y*boxes[t].rect.height);
+	}
+	if (dd->doing_blobs) {
+		if (render_drawing_surf) {
+			render_blobs(drawing_cr, &dd->blob_tracker);
+		}
+		render_blobs(screen_cr, &dd->blob_tracker);
 	}
 
 	clock_gettime(CLOCK_REALTIME, &snapshot_ts);
-	int drawing_size = 4 * dd->drawing_frame->width * dd->drawing_frame->height;
-	uint tsize = drawing_size + sizeof(struct timespec);
+	cairo_surface_flush(drawing_surf);
 	if (dd->do_snapshot) {
-		if (jack_ringbuffer_write_space(dd->snapshot_thread_info.ring_buf) >= (size_t)tsize) {
-			jack_ringbuffer_write(dd->snapshot_thread_info.ring_buf, (const char *)dd->drawing_frame->data[0],
-					drawing_size);
-			jack_ringbuffer_write(dd->snapshot_thread_info.ring_buf, (const char *)&snapshot_ts,
-								  sizeof(ts));
-			if (pthread_mutex_trylock(&dd->snapshot_thread_info.lock) == 0) {
-				pthread_cond_signal(&dd->snapshot_thread_info.data_ready);
-				pthread_mutex_unlock(&dd->snapshot_thread_info.lock);
-			}
+		/* Asked for after drawing began, so the layer went to the
+		 * scratch frame. */
+		if (!recorded && (recorded = dd->frame_pool.get())) {
+			av_image_copy_plane(recorded->data[0], recorded->linesize[0],
+								dd->drawing_frame->data[0], dd->drawing_frame->linesize[0],
+								4 * recorded->width, recorded->height);
+		}
+		if (recorded && frame_queue_push(dd->snapshot_thread_info.ring_buf, recorded, &snapshot_ts)) {
+			dd->snapshot_thread_info.data_ready.notify();
 		}
 		dd->do_snapshot = 0;
 	}
 	if (dd->recording_stopped) {
-		if (pthread_mutex_trylock(&dd->video_thread_info.lock) == 0) {
-			pthread_cond_signal(&dd->video_thread_info.data_ready);
-			pthread_mutex_unlock(&dd->video_thread_info.lock);
-		}
+		dd->video_thread_info.data_ready.notify();
 	}
 	if (dd->recording_started && !dd->recording_stopped) {
 		clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -618,103 +947,80 @@ void process_image(cairo_t *screen_cr, void *arg) {
 			dd->video_thread_info.stream.first_time = ts;
 			dd->can_capture = 1;
 		}
-		tsize = drawing_size + sizeof(struct timespec);
-		if (jack_ringbuffer_write_space(video_ring_buf) >= tsize) {
-			jack_ringbuffer_write(video_ring_buf, (const char *)dd->drawing_frame->data[0],
-					drawing_size);
-			jack_ringbuffer_write(video_ring_buf, (const char *)&ts,
-								  sizeof(struct timespec));
-			if (pthread_mutex_trylock(&dd->video_thread_info.lock) == 0) {
-				pthread_cond_signal(&dd->video_thread_info.data_ready);
-				pthread_mutex_unlock(&dd->video_thread_info.lock);
-			}
+		if (recorded && frame_queue_push(video_ring_buf, recorded, &ts)) {
+			dd->video_thread_info.data_ready.notify();
 		}
 	}
 	cairo_destroy(sources_cr);
 	cairo_destroy(drawing_cr);
 	cairo_surface_destroy(sources_surf);
 	cairo_surface_destroy(drawing_surf);
+	av_frame_free(&recorded);
 	clock_gettime(CLOCK_MONOTONIC, &end_ts);
 	struct timespec diff_ts;
 	timespec_diff(&start_ts, &end_ts, &diff_ts);
 	printf("process_image time: %f\n", timespec_to_seconds(&diff_ts)*1000);
 }
 
-double hanning_window(int i, int N) {
-	return 0.5 * (1 - cos(2 * M_PI * i / (N - 1)));
-}
-
 int process(jack_nframes_t nframes, void *arg) {
 	DingleDots *dd = (DingleDots *)arg;
 	static int first_call = 1;
+	int mixed = 0;
 	if (!dd->can_process) return 0;
 	midi_process_output(nframes, dd);
-	for (int chn = 0; chn < dd->nports; chn++) {
+	for (int chn = 0; chn < dd->ninputs; chn++) {
 		dd->in[chn] = (jack_default_audio_sample_t *)jack_port_get_buffer(dd->in_ports[chn], nframes);
-		dd->out[chn] = (jack_default_audio_sample_t *)jack_port_get_buffer(dd->out_ports[chn], nframes);
-		kmeter_process(&dd->meters[chn], dd->in[chn], nframes);
 	}
-	if (nframes >= FFT_SIZE) {
-		for (int i = 0; i < FFT_SIZE; i++) {
-			fftw_in[i][0] = dd->in[0][i] * hanning_window(i, FFT_SIZE);
-			fftw_in[i][1] = 0.0;
-		}
-		fftw_execute(p);
+	for (int chn = 0; chn < dd->noutputs; chn++) {
+		dd->out[chn] = (jack_default_audio_sample_t *)jack_port_get_buffer(dd->out_ports[chn], nframes);
 	}
+	kmeter_process_multi(dd->meters, dd->in, dd->ninputs, nframes);
+	dd->spectrum.write(dd->in[0], nframes);
+	dd->beats.write(dd->in[0], nframes, jack_last_frame_time(dd->client));
 	if (first_call) {
 		struct timespec *ats = &dd->audio_thread_info.stream.first_time;
 		clock_gettime(CLOCK_MONOTONIC, ats);
 		dd->audio_thread_info.stream.samples_count = 0;
 		first_call = 0;
 	}
-	for (uint i = 0; i < nframes; i++) {
-		for (int chn = 0; chn < dd->nports; chn++) {
-			dd->out[chn][i] = dd->in[chn][i];
-		}
-	}
+	mixer_apply_routes(dd->in, dd->out, dd->noutputs, dd->routes, dd->nroutes, nframes);
 	for (int i = 0; i < MAX_NUM_VIDEO_FILES; ++i) {
 		VideoFile *vf = &dd->vf[i];
 		if (vf->active && vf->audio_playing && !vf->paused) {
-			jack_default_audio_sample_t sample;
 			if (vf->audio_decoding_started) {
 				if (vf->audio_decoding_finished &&
 						jack_ringbuffer_read_space(vf->abuf) == 0) {
 					vf->audio_playing = 0;
-					if (pthread_mutex_trylock(&vf->video_lock) == 0) {
-						pthread_cond_signal(&vf->video_data_ready);
-						pthread_mutex_unlock(&vf->video_lock);
-					}
+					vf->video_data_ready.notify();
 				} else{
-					for (uint frm = 0; frm < nframes; ++frm) {
-						for (int chn = 0; chn < 2; ++chn) {
-							if (jack_ringbuffer_read_space(vf->abuf) >= sizeof(sample)) {
-								jack_ringbuffer_read(vf->abuf, (char *)&sample, sizeof(sample));
-								dd->out[chn][frm] += sample;
-							}
-						}
-					}
+					mixer_add_source(vf->abuf, vf->channels, vf->gain, dd->out, dd->noutputs, nframes);
+					mixed = 1;
 					vf->nb_frames_played += nframes;
-					if (pthread_mutex_trylock(&vf->audio_lock) == 0) {
-						pthread_cond_signal(&vf->audio_data_ready);
-						pthread_mutex_unlock(&vf->audio_lock);
-					}
+					vf->audio_data_ready.notify();
 				}
 			}
 		}
 	}
-	if (dd->recording_started && !dd->audio_done) {
-		for (uint i = 0; i < nframes; i++) {
-			for (int chn = 0; chn < dd->nports; chn++) {
-				if (jack_ringbuffer_write (audio_ring_buf, (const char *) (dd->out[chn]+i),
-										   sample_size) < sample_size) {
-					printf("jack overrun: %ld\n", ++dd->jack_overruns);
-				}
-			}
+	if (dd->synth.active) {
+		dd->synth.render(dd->out, dd->noutputs, nframes, jack_last_frame_time(dd->client));
+		mixed = 1;
+	}
+	if (mixed) {
+		for (int chn = 0; chn < dd->noutputs; chn++) {
+			mixer_soft_clip(dd->out[chn], nframes);
 		}
-		if (pthread_mutex_trylock (&dd->audio_thread_info.lock) == 0) {
-			pthread_cond_signal (&dd->audio_thread_info.data_ready);
-			pthread_mutex_unlock (&dd->audio_thread_info.lock);
+	}
+	if (dd->latency_probe.active) {
+		dd->latency_probe.process(dd->in[0], dd->out, dd->noutputs,
+								  jack_port_get_buffer(dd->midi_in_port, nframes),
+								  jack_port_get_buffer(dd->midi_port, nframes),
+								  nframes, jack_last_frame_time(dd->client));
+	}
+	if (dd->recording_started && !dd->audio_done) {
+		if (audio_ring_write_period(audio_ring_buf, dd->out, dd->noutputs, nframes)) {
+			dd->jack_overruns.fetch_add(1, std::memory_order_relaxed);
 		}
+		dd->audio_thread_info.data_ready.notify();
 	}
 	return 0;
 }
@@ -724,8 +1030,27 @@ void jack_shutdown (void *) {
 	abort();
 }
 
+static gboolean beat_redraw_cb(gpointer data) {
+	DingleDots *dd = (DingleDots *)data;
+	dd->beat_redraw_pending = 0;
+	if (dd->drawing_area) {
+		gtk_widget_queue_draw(dd->drawing_area);
+	}
+	return FALSE;
+}
+
+/* Called on the beat thread, so the GUI sees a beat without waiting
+ * for the next camera frame. GTK is only touched from the main loop,
+ * and a burst of beats queues a single redraw. */
+static void beat_wake(void *arg) {
+	DingleDots *dd = (DingleDots *)arg;
+	if (!dd->beat_redraw_pending.exchange(1)) {
+		g_idle_add(beat_redraw_cb, dd);
+	}
+}
+
 void setup_jack(DingleDots *dd) {
-	size_t in_size;
+	size_t in_size, out_size;
 	dd->can_process = 0;
 	dd->jack_overruns = 0;
 	if ((dd->client = jack_client_open("v4l2_wayland",
@@ -738,21 +1063,43 @@ void setup_jack(DingleDots *dd) {
 	if (jack_activate(dd->client)) {
 		printf("cannot activate jack client\n");
 	}
-	dd->in_ports = (jack_port_t **) malloc(sizeof(jack_port_t *) * dd->nports);
-	dd->out_ports = (jack_port_t **) malloc(sizeof(jack_port_t *) * dd->nports);
-	in_size =  dd->nports * sizeof (jack_default_audio_sample_t *);
+	dd->in_ports = (jack_port_t **) malloc(sizeof(jack_port_t *) * dd->ninputs);
+	dd->out_ports = (jack_port_t **) malloc(sizeof(jack_port_t *) * dd->noutputs);
+	in_size =  dd->ninputs * sizeof (jack_default_audio_sample_t *);
+	out_size =  dd->noutputs * sizeof (jack_default_audio_sample_t *);
 	dd->in = (jack_default_audio_sample_t **) malloc (in_size);
-	dd->out = (jack_default_audio_sample_t **) malloc (in_size);
-	audio_ring_buf = jack_ringbuffer_create (dd->nports * sample_size *
+	dd->out = (jack_default_audio_sample_t **) malloc (out_size);
+	audio_ring_buf = jack_ringbuffer_create (dd->noutputs * sample_size *
 											 16384);
 	memset(dd->in, 0, in_size);
-	memset(dd->out, 0, in_size);
+	memset(dd->out, 0, out_size);
 	memset(audio_ring_buf->buf, 0, audio_ring_buf->size);
+	for (int i = 0; i < dd->ninputs; i++) {
+		kmeter_init(&dd->meters[i], jack_get_sample_rate(dd->client),
+					jack_get_buffer_size(dd->client), 0.5, 15,
+					dd->drawing_rect.width * (i + 1) / (dd->ninputs + 1),
+					dd->drawing_rect.height / 2, dd->drawing_rect.height / 4,
+					dd->random_color());
+	}
 	dd->midi_ring_buf = jack_ringbuffer_create(MIDI_RB_SIZE);
-	fftw_in = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
-	fftw_out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
-	p = fftw_plan_dft_1d(FFT_SIZE, fftw_in, fftw_out, FFTW_FORWARD, FFTW_ESTIMATE);
-	for (int i = 0; i < dd->nports; i++) {
+	dd->midi_off_ring_buf = jack_ringbuffer_create(MIDI_OFF_RB_SIZE);
+	dd->midi_cc_ring_buf = jack_ringbuffer_create(MIDI_CC_RB_SIZE);
+	memset(&dd->midi_ccs, 0, sizeof(dd->midi_ccs));
+	dd->midi_last_time = jack_frame_time(dd->client);
+	if (dd->synth_enabled) {
+		dd->synth.init(jack_get_sample_rate(dd->client));
+	}
+#if defined(RENDER_FFT)
+	/* The bars are the analyzer's only reader. */
+	if (dd->spectrum.init(dd->fft_size)) {
+		jack_client_close(dd->client);
+		exit(1);
+	}
+#endif
+	if (dd->beat_pulse || dd->beat_snapshot || dd->midi_clock) {
+		dd->beats.init(jack_get_sample_rate(dd->client), beat_wake, dd);
+	}
+	for (int i = 0; i < dd->ninputs; i++) {
 		char name[64];
 		sprintf(name, "input%d", i + 1);
 		if ((dd->in_ports[i] = jack_port_register (dd->client, name, JACK_DEFAULT_AUDIO_TYPE,
@@ -761,6 +1108,9 @@ void setup_jack(DingleDots *dd) {
 			jack_client_close(dd->client);
 			exit(1);
 		}
+	}
+	for (int i = 0; i < dd->noutputs; i++) {
+		char name[64];
 		sprintf(name, "output%d", i + 1);
 		if ((dd->out_ports[i] = jack_port_register (dd->client, name, JACK_DEFAULT_AUDIO_TYPE,
 													JackPortIsOutput, 0)) == 0) {
@@ -771,17 +1121,79 @@ void setup_jack(DingleDots *dd) {
 	}
 	dd->midi_port = jack_port_register(dd->client, "output_midi",
 									   JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+	if (dd->measure_latency) {
+		dd->midi_in_port = jack_port_register(dd->client, "input_midi",
+											  JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+		dd->latency_probe.init(jack_get_sample_rate(dd->client), dd->measure_latency);
+	}
 	dd->can_process = 1;
 }
 
+/* With nothing wired to an input, loop our own output back to it, so
+ * the measurement also works on a dummy backend with no hardware. */
+static void connect_probe_loopback(DingleDots *dd) {
+	if (!jack_port_connected(dd->in_ports[0]) &&
+			jack_connect(dd->client, jack_port_name(dd->out_ports[0]),
+						 jack_port_name(dd->in_ports[0]))) {
+		fprintf(stderr, "cannot connect audio loopback\n");
+	}
+	if (!jack_port_connected(dd->midi_in_port) &&
+			jack_connect(dd->client, jack_port_name(dd->midi_port),
+						 jack_port_name(dd->midi_in_port))) {
+		fprintf(stderr, "cannot connect MIDI loopback\n");
+	}
+}
+
+/* Runs the latency probes headless and prints the results. */
+static void measure_latency(DingleDots *dd) {
+	struct timespec pause;
+	double waited = 0;
+	double limit = dd->measure_latency * (PROBE_INTERVAL + PROBE_TIMEOUT) + 1;
+	pause.tv_sec = 0;
+	pause.tv_nsec = 10000000;
+	connect_probe_loopback(dd);
+	while (!dd->latency_probe.done() && waited < limit) {
+		nanosleep(&pause, NULL);
+		waited += 0.01;
+	}
+	dd->latency_probe.report(stdout, dd->client, dd->out_ports[0], dd->in_ports[0]);
+}
+
 void teardown_jack(DingleDots *dd) {
-	while (jack_ringbuffer_read_space(dd->midi_ring_buf)) {
+	/* With the clock off the next period sends a stop. */
+	dd->midi_clock = 0;
+	while (jack_ringbuffer_read_space(dd->midi_ring_buf) ||
+		   jack_ringbuffer_read_space(dd->midi_off_ring_buf) ||
+		   !dd->midi_off_backlog.empty() || dd->midi_clock_started) {
+		midi_flush_note_offs(dd);
 		struct timespec pause;
 		pause.tv_sec = 0;
 		pause.tv_nsec = 1000;
 		nanosleep(&pause, NULL);
 	}
 	jack_client_close(dd->client);
+	if (dd->spectrum.overruns.load(std::memory_order_relaxed)) {
+		fprintf(stderr, "%ld spectrum periods dropped\n",
+				dd->spectrum.overruns.load(std::memory_order_relaxed));
+	}
+	dd->spectrum.free();
+	dd->synth.free();
+	if (dd->synth.dropped_events) {
+		fprintf(stderr, "%ld synth events dropped\n", dd->synth.dropped_events);
+	}
+	dd->latency_probe.free();
+	dd->beats.free();
+	if (dd->beats.overruns.load(std::memory_order_relaxed)) {
+		fprintf(stderr, "%ld beat tracker periods dropped\n",
+				dd->beats.overruns.load(std::memory_order_relaxed));
+	}
+	if (dd->beats.dropped_events.load(std::memory_order_relaxed)) {
+		fprintf(stderr, "%ld beat events dropped\n",
+				dd->beats.dropped_events.load(std::memory_order_relaxed));
+	}
+	if (dd->midi_cc_dropped) {
+		fprintf(stderr, "%ld MIDI controller changes dropped\n", dd->midi_cc_dropped);
+	}
 }
 
 void start_recording(DingleDots *dd) {
@@ -800,7 +1212,11 @@ void start_recording(DingleDots *dd) {
 }
 
 void stop_recording(DingleDots *dd) {
+	long overruns = dd->jack_overruns.load(std::memory_order_relaxed);
 	dd->recording_stopped = 1;
+	if (overruns) {
+		printf("jack overruns: %ld periods dropped\n", overruns);
+	}
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dd->record_button), 0);
 	gtk_widget_set_sensitive(dd->record_button, 0);
 }
@@ -1130,22 +1546,20 @@ static gboolean button_press_event_cb(GtkWidget *,
 		return FALSE;
 	}
 
-//	if (!dd->shift_pressed && event->button == GDK_BUTTON_SECONDARY) {
-//		dd->smdown = 1;
-//		dd->mdown_pos.x = dd->mouse_pos.x;
-//		dd->mdown_pos.y = dd->mouse_pos.y;
-//		dd->user_tld_rect.x = dd->mdown_pos.x;
-//		dd->user_tld_rect.y = dd->mdown_pos.y;
-//		dd->user_tld_rect.width = 20 * dd->ascale_factor_x;
-//		dd->user_tld_rect.height = 20 * dd->ascale_factor_y;
-//		return TRUE;
-//	}
-//	if (dd->doing_tld && dd->shift_pressed) {
-//		if (event->button == GDK_BUTTON_SECONDARY) {
-//			dd->doing_tld = 0;
-//			return TRUE;
-//		}
-//	}
+	if (!(event->state & GDK_SHIFT_MASK) && event->button == GDK_BUTTON_SECONDARY) {
+		dd->smdown = 1;
+		dd->mdown_pos.x = dd->mouse_pos.x;
+		dd->mdown_pos.y = dd->mouse_pos.y;
+		dd->user_tld_rect.x = dd->mdown_pos.x;
+		dd->user_tld_rect.y = dd->mdown_pos.y;
+		dd->user_tld_rect.width = 20 * dd->ascale_factor_x;
+		dd->user_tld_rect.height = 20 * dd->ascale_factor_y;
+		return TRUE;
+	}
+	if ((event->state & GDK_SHIFT_MASK) && event->button == GDK_BUTTON_SECONDARY) {
+		stop_tld_trackers(dd, dd->mouse_pos.x, dd->mouse_pos.y);
+		return TRUE;
+	}
 	return FALSE;
 }
 
@@ -1191,12 +1605,12 @@ static gboolean button_release_event_cb(GtkWidget *,
 		}
 		gtk_widget_queue_draw(dd->drawing_area);
 		return TRUE;
-	} /*else if (!(event->state & GDK_SHIFT_MASK) && event->button == GDK_BUTTON_SECONDARY) {
+	} else if (event->button == GDK_BUTTON_SECONDARY && dd->smdown) {
 		dd->smdown = 0;
 		dd->make_new_tld = 1;
 		dd->doing_tld = 1;
 		return TRUE;
-	}*/
+	}
 	return FALSE;
 }
 
@@ -1265,6 +1679,13 @@ static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event,
 		} else {
 			gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dd->delete_button), 0);
 		}
+	} else if (event->keyval == GDK_KEY_p) {
+		for (int i = 0; i < MAX_NUM_SOUND_SHAPES; i++) {
+			SoundShape *ss = &dd->sound_shapes[i];
+			if (!ss->active || !ss->selected) continue;
+			ss->patch = (ss->patch + 1) % SYNTH_NUM_PATCHES;
+		}
+		return TRUE;
 	} else if (event->keyval == GDK_KEY_s ||
 			   event->keyval == GDK_KEY_S) {
 		dd->s_pressed = 1;
@@ -1403,6 +1824,56 @@ static gboolean motion_cb(GtkWidget *widget, gpointer data) {
 	return TRUE;
 }
 
+static gboolean flow_cb(GtkWidget *widget, gpointer data) {
+	DingleDots *dd = (DingleDots*) data;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
+		dd->doing_flow = 1;
+	} else {
+		dd->doing_flow = 0;
+		for (int i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
+			dd->sound_shapes[i].velocity = 64;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean blobs_cb(GtkWidget *widget, gpointer data) {
+	DingleDots *dd = (DingleDots*) data;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
+		dd->doing_blobs = 1;
+	} else {
+		dd->doing_blobs = 0;
+		dd->blob_tracker.reset();
+		for (int i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
+			dd->sound_shapes[i].blob_state = 0;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean detect_cb(GtkWidget *widget, gpointer data) {
+	DingleDots *dd = (DingleDots*) data;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
+		if (!dd->detector.active) {
+			fprintf(stderr, "No detector cascade, use --detector-cascade\n");
+			gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(widget), FALSE);
+			return TRUE;
+		}
+		dd->doing_detect = 1;
+	} else {
+		dd->doing_detect = 0;
+		for (int i = 0; i < MAX_NUM_SOUND_SHAPES; ++i) {
+			SoundShape *s = &dd->sound_shapes[i];
+			if (s->active && s->detection_id >= 0) {
+				s->detection_id = -1;
+				s->detect_state = 0;
+				s->deactivate();
+			}
+		}
+	}
+	return TRUE;
+}
+
 static gboolean snapshot_shape_cb(GtkWidget *widget, gpointer data) {
 	DingleDots *dd = (DingleDots*) data;
 	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
@@ -1521,22 +1992,27 @@ static gboolean make_scale_cb(GtkWidget *, gpointer data) {
 	color c;
 	dd = (DingleDots *)data;
 	char *text_scale;
-	char text_note[4];
+	char *text_channel;
+	const gchar *note_id;
 	int channel;
+	note_id = gtk_combo_box_get_active_id(GTK_COMBO_BOX(dd->note_combo));
+	if (!note_id) return TRUE;
 	text_scale =
 			gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(dd->scale_combo));
-	sprintf(text_note, "%s",
-			gtk_combo_box_get_active_id(GTK_COMBO_BOX(dd->note_combo)));
+	if (!text_scale) return TRUE;
 	midi_key_t key;
-	midi_key_init_by_scale_id(&key, atoi(text_note),
+	midi_key_init_by_scale_id(&key, atoi(note_id),
 							  midi_scale_text_to_id(text_scale));
+	g_free(text_scale);
 	if (dd->use_rand_color_for_scale) {
 		c = dd->random_color();
 	} else {
 		gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(dd->scale_color_button), &gc);
 		color_init(&c, gc.red, gc.green, gc.blue, gc.alpha);
 	}
-	channel = atoi(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(dd->channel_combo)));
+	text_channel = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(dd->channel_combo));
+	channel = text_channel ? atoi(text_channel) : 0;
+	g_free(text_channel);
 	dd->add_scale(&key, channel, &c);
 	return TRUE;
 }
@@ -1549,6 +2025,9 @@ static void activate(GtkApplication *app, gpointer user_data) {
 	GtkWidget *vbox;
 	GtkWidget *qbutton;
 	GtkWidget *mbutton;
+	GtkWidget *flow_button;
+	GtkWidget *blobs_button;
+	GtkWidget *detect_button;
 	GtkWidget *play_file_button;
 	GtkWidget *show_sprite_button;
 	GtkWidget *snapshot_button;
@@ -1586,13 +2065,8 @@ static void activate(GtkApplication *app, gpointer user_data) {
 		fprintf(stderr, "Could not allocate sources buffer\n");
 		exit(1);
 	}
-	uint32_t rb_size = 5 * 4 * dd->drawing_frame->linesize[0] *
-			dd->drawing_frame->height;
-	video_ring_buf = jack_ringbuffer_create(rb_size);
-	memset(video_ring_buf->buf, 0, video_ring_buf->size);
-	dd->snapshot_thread_info.ring_buf = jack_ringbuffer_create(rb_size);
-	memset(dd->snapshot_thread_info.ring_buf->buf, 0,
-		   dd->snapshot_thread_info.ring_buf->size);
+	dd->frame_pool.init(dd->drawing_rect.width, dd->drawing_rect.height);
+	video_ring_buf = frame_queue_create();
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_resizable(GTK_WINDOW(window), TRUE);
 	gtk_window_set_deletable(GTK_WINDOW (window), TRUE);
@@ -1619,12 +2093,18 @@ static void activate(GtkApplication *app, gpointer user_data) {
 	dd->delete_button = gtk_toggle_button_new_with_label("DELETE");
 	qbutton = gtk_button_new_with_label("QUIT");
 	mbutton = gtk_check_button_new_with_label("MOTION DETECTION");
+	flow_button = gtk_check_button_new_with_label("MOTION VELOCITY");
+	blobs_button = gtk_check_button_new_with_label("BLOB TRACKING");
+	detect_button = gtk_check_button_new_with_label("DETECTION");
 	snapshot_shape_button = gtk_check_button_new_with_label("MOTION SNAPSHOT CONTROLLER");
 	play_file_button = gtk_button_new_with_label("PLAY VIDEO FILE");
 	show_sprite_button = gtk_button_new_with_label("SHOW IMAGE");
 	snapshot_button = gtk_button_new_with_label("TAKE SNAPSHOT");
 	camera_button = gtk_button_new_with_label("OPEN CAMERA");
 	gtk_box_pack_start(GTK_BOX(toggle_hbox), mbutton, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(toggle_hbox), flow_button, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(toggle_hbox), blobs_button, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(toggle_hbox), detect_button, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(toggle_hbox), snapshot_shape_button, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(vbox), dd->record_button, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(vbox), snapshot_button, FALSE, FALSE, 0);
@@ -1692,6 +2172,9 @@ static void activate(GtkApplication *app, gpointer user_data) {
 	g_signal_connect(camera_button, "clicked", G_CALLBACK(camera_cb), dd);
 	g_signal_connect(make_scale_button, "clicked", G_CALLBACK(make_scale_cb), dd);
 	g_signal_connect(mbutton, "toggled", G_CALLBACK(motion_cb), dd);
+	g_signal_connect(flow_button, "toggled", G_CALLBACK(flow_cb), dd);
+	g_signal_connect(blobs_button, "toggled", G_CALLBACK(blobs_cb), dd);
+	g_signal_connect(detect_button, "toggled", G_CALLBACK(detect_cb), dd);
 	g_signal_connect(play_file_button, "clicked", G_CALLBACK(play_file_cb), dd);
 	g_signal_connect(show_sprite_button, "clicked", G_CALLBACK(show_sprite_cb), dd);
 	g_signal_connect(dd->rand_color_button, "toggled", G_CALLBACK(rand_color_cb), dd);
@@ -1753,18 +2236,80 @@ static void usage(DingleDots *, FILE *fp, int, char **argv)
 			"-w	| --width         display width in pixels"
 			"-g | --height        display height in pixels"
 			"-b | --bitrate       bit rate of video file output\n"
+			"-e | --encoder       video encoder, e.g. libx264, libvpx-vp9 or ffv1, default from the file extension\n"
+			"-p | --preset        encoder preset, e.g. veryfast for libx264 or realtime, good, best for libvpx,\n"
+			"                     which takes libx264 names as the nearest of those\n"
+			"-j | --encoder-threads encoder threads, 0 lets the encoder choose\n"
+			"-l | --encoder-threading slice, frame or auto\n"
+			"-G | --gop           frames between key frames\n"
+			"-Q | --rate-control  vbr, cbr or crf[:quality]\n"
+			"-X | --encoder-option key=value[:key=value...] passed to the encoder, repeatable\n"
+			"-c | --flow-speed-cc midi cc number for motion speed\n"
+			"-a | --flow-direction-cc midi cc number for motion direction\n"
+			"-f | --flow-full-scale motion speed in pixels per frame for velocity 127\n"
+			"-t | --threads       number of analysis threads\n"
+			"-m | --motion-level-radius smallest shape radius in pixels on the analysis level used for motion\n"
+			"-B | --bench-motion  time motion evaluation for 1..N threads and exit\n"
+			"-V | --bench-yuv     time the recorder's BGRA to YUV420P conversion against sws_scale and exit\n"
+			"-T | --tracker       object tracker for box selections, tld or mosse\n"
+			"-F | --fft-size      spectrum analysis size in samples, a power of two\n"
+			"-D | --detector-cascade ccv SCD cascade file or BBF cascade directory for DETECTION\n"
+			"-L | --midi-latency  milliseconds from camera capture to MIDI output\n"
+			"-Y | --synth         play sound shapes on the built in synth as well as MIDI\n"
+			"-C | --motion-cc     midi cc number driven by each shape's motion\n"
+			"-E | --motion-bend   drive pitch bend from each shape's motion\n"
+			"-P | --motion-pressure drive channel pressure from each shape's motion\n"
+			"-M | --measure-latency send N audio and MIDI probes through a loopback, report round trip latency and exit\n"
+			"-I | --inputs        number of JACK input ports\n"
+			"-O | --outputs       number of JACK output ports\n"
+			"-R | --route         in:out[:gain] mix input port in into output port out, repeatable,\n"
+			"                     without any each input feeds the output of the same number\n"
+			"-A | --file-gain     gain applied to the audio of video files, 1.0 for unity\n"
+			"-U | --beat-pulse    pulse the sound shapes on beats tracked in the first input\n"
+			"-S | --beat-snapshot take a snapshot on every beat\n"
+			"-K | --midi-clock    send MIDI clock locked to the tracked beats\n"
 			"",
 			argv[0]);
 }
 
-static const char short_options[] = "d:ho:b:w:g:x:y:";
+static const char short_options[] = "d:ho:b:e:p:j:l:G:Q:X:w:g:x:y:c:a:f:t:m:BVT:D:F:L:YC:EPM:I:O:R:A:USK";
 
 static const struct option
 		long_options[] = {
 { "help",   no_argument,       NULL, 'h' },
 { "bitrate", required_argument, NULL, 'b' },
+{ "encoder", required_argument, NULL, 'e' },
+{ "preset", required_argument, NULL, 'p' },
+{ "encoder-threads", required_argument, NULL, 'j' },
+{ "encoder-threading", required_argument, NULL, 'l' },
+{ "gop", required_argument, NULL, 'G' },
+{ "rate-control", required_argument, NULL, 'Q' },
+{ "encoder-option", required_argument, NULL, 'X' },
 { "width", required_argument, NULL, 'w' },
 { "height", required_argument, NULL, 'g' },
+{ "flow-speed-cc", required_argument, NULL, 'c' },
+{ "flow-direction-cc", required_argument, NULL, 'a' },
+{ "flow-full-scale", required_argument, NULL, 'f' },
+{ "threads", required_argument, NULL, 't' },
+{ "motion-level-radius", required_argument, NULL, 'm' },
+{ "bench-motion", no_argument, NULL, 'B' },
+{ "bench-yuv", no_argument, NULL, 'V' },
+{ "tracker", required_argument, NULL, 'T' },
+{ "detector-cascade", required_argument, NULL, 'D' },
+{ "fft-size", required_argument, NULL, 'F' },
+{ "midi-latency", required_argument, NULL, 'L' },
+{ "synth", no_argument, NULL, 'Y' },
+{ "motion-cc", required_argument, NULL, 'C' },
+{ "motion-bend", no_argument, NULL, 'E' },
+{ "motion-pressure", no_argument, NULL, 'P' },
+{ "measure-latency", required_argument, NULL, 'M' },
+{ "inputs", required_argument, NULL, 'I' },
+{ "outputs", required_argument, NULL, 'O' },
+{ "route", required_argument, NULL, 'R' },
+{ "file-gain", required_argument, NULL, 'A' },
+{ "beat-pulse", no_argument, NULL, 'U' },
+{ "beat-snapshot", no_argument, NULL, 'S' },
+{ "midi-clock", no_argument, NULL, 'K' },
 { 0, 0, 0, 0 }
 };
 
@@ -1773,6 +2318,32 @@ int main(int argc, char **argv) {
 	int width = 1280;
 	int height = 720;
 	int video_bitrate = 1000000;
+	encoder_settings encoder;
+	int flow_speed_cc = -1;
+	int flow_direction_cc = -1;
+	double flow_full_scale_speed = 24.0;
+	int nthreads = ThreadPool::default_nthreads();
+	double min_level_radius = 16.0;
+	int do_bench_motion = 0;
+	int do_bench_yuv = 0;
+	int tracker_type = TRACKER_TLD;
+	char *detector_cascade = NULL;
+	int fft_size = SPECTRUM_DEFAULT_SIZE;
+	double midi_latency = MIDI_DEFAULT_LATENCY;
+	int synth_enabled = 0;
+	int motion_cc = -1;
+	int motion_bend = 0;
+	int motion_pressure = 0;
+	int nprobes = 0;
+	int ninputs = 2;
+	int noutputs = 2;
+	mixer_route routes[MAX_NUM_PORTS * MAX_NUM_PORTS];
+	int nroutes = 0;
+	double file_gain = 1.0;
+	encoder_settings_default(&encoder);
+	int beat_pulse = 0;
+	int beat_snapshot = 0;
+	int midi_clock = 0;
 	srand(time(NULL));
 	for (;;) {
 		int idx;
@@ -1787,12 +2358,132 @@ int main(int argc, char **argv) {
 			case 'b':
 				video_bitrate = atoi(optarg);
 				break;
+			case 'e':
+				encoder.codec = optarg;
+				break;
+			case 'p':
+				encoder.preset = optarg;
+				break;
+			case 'j':
+				encoder.threads = atoi(optarg);
+				break;
+			case 'l':
+				if (encoder_parse_thread_type(&encoder, optarg) < 0) {
+					fprintf(stderr, "Unknown encoder threading %s\n", optarg);
+					usage(&dingle_dots, stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'G':
+				encoder.gop_size = atoi(optarg);
+				break;
+			case 'Q':
+				if (encoder_parse_rate_control(&encoder, optarg) < 0) {
+					fprintf(stderr, "Unknown rate control %s\n", optarg);
+					usage(&dingle_dots, stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'X':
+				if (av_dict_parse_string(&encoder.options, optarg, "=", ":", 0) < 0) {
+					fprintf(stderr, "Encoder options must be key=value, not %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'w':
 				width = atoi(optarg);
 				break;
 			case 'g':
 				height = atoi(optarg);
 				break;
+			case 'c':
+				flow_speed_cc = atoi(optarg);
+				break;
+			case 'a':
+				flow_direction_cc = atoi(optarg);
+				break;
+			case 'f':
+				flow_full_scale_speed = atof(optarg);
+				break;
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'm':
+				min_level_radius = atof(optarg);
+				break;
+			case 'B':
+				do_bench_motion = 1;
+				break;
+			case 'V':
+				do_bench_yuv = 1;
+				break;
+			case 'T':
+				if (strcmp(optarg, "tld") == 0) {
+					tracker_type = TRACKER_TLD;
+				} else if (strcmp(optarg, "mosse") == 0) {
+					tracker_type = TRACKER_MOSSE;
+				} else {
+					fprintf(stderr, "Unknown tracker %s\n", optarg);
+					usage(&dingle_dots, stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'D':
+				detector_cascade = optarg;
+				break;
+			case 'F':
+				fft_size = atoi(optarg);
+				break;
+			case 'L':
+				midi_latency = atof(optarg) / 1000.;
+				break;
+			case 'Y':
+				synth_enabled = 1;
+				break;
+			case 'C':
+				motion_cc = atoi(optarg);
+				break;
+			case 'E':
+				motion_bend = 1;
+				break;
+			case 'P':
+				motion_pressure = 1;
+				break;
+			case 'M':
+				nprobes = atoi(optarg);
+				break;
+			case 'I':
+				ninputs = atoi(optarg);
+				break;
+			case 'O':
+				noutputs = atoi(optarg);
+				break;
+			case 'R':
+				if (nroutes == MAX_NUM_PORTS * MAX_NUM_PORTS) {
+					fprintf(stderr, "Too many routes\n");
+					exit(EXIT_FAILURE);
+				}
+				routes[nroutes].gain = 1.0f;
+				if (sscanf(optarg, "%d:%d:%f", &routes[nroutes].in, &routes[nroutes].out,
+						   &routes[nroutes].gain) < 2) {
+					fprintf(stderr, "Bad route %s, expected in:out[:gain]\n", optarg);
+					usage(&dingle_dots, stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				nroutes++;
+				break;
+			case 'A':
+				file_gain = atof(optarg);
+				break;
+			case 'U':
+				beat_pulse = 1;
+				break;
+			case 'S':
+				beat_snapshot = 1;
+				break;
+			case 'K':
+				midi_clock = 1;
+				break;
 			case 'h':
 				usage(&dingle_dots, stdout, argc, argv);
 				exit(EXIT_SUCCESS);
@@ -1801,14 +2492,85 @@ int main(int argc, char **argv) {
 				exit(EXIT_FAILURE);
 		}
 	}
+	if (flow_speed_cc < -1 || flow_speed_cc > 127 ||
+			flow_direction_cc < -1 || flow_direction_cc > 127 ||
+			motion_cc < -1 || motion_cc > 127) {
+		fprintf(stderr, "MIDI cc numbers must be between 0 and 127, or -1 for off\n");
+		usage(&dingle_dots, stderr, argc, argv);
+		exit(EXIT_FAILURE);
+	}
+	if (ninputs < 1 || ninputs > MAX_NUM_PORTS || noutputs < 1 || noutputs > MAX_NUM_PORTS) {
+		fprintf(stderr, "Port counts must be between 1 and %d\n", MAX_NUM_PORTS);
+		exit(EXIT_FAILURE);
+	}
+	for (int r = 0; r < nroutes; r++) {
+		if (routes[r].in < 1 || routes[r].in > ninputs ||
+				routes[r].out < 1 || routes[r].out > noutputs) {
+			fprintf(stderr, "Route %d:%d is outside the %d inputs and %d outputs\n",
+					routes[r].in, routes[r].out, ninputs, noutputs);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (file_gain < 0.0) {
+		fprintf(stderr, "File gain must be 0 or more\n");
+		usage(&dingle_dots, stderr, argc, argv);
+		exit(EXIT_FAILURE);
+	}
+	if (encoder.threads < 0 || encoder.gop_size < 1) {
+		fprintf(stderr, "Encoder threads must be 0 or more and the gop 1 or more\n");
+		exit(EXIT_FAILURE);
+	}
+	if (do_bench_motion) {
+		bench_motion(width, height, min_level_radius);
+		exit(EXIT_SUCCESS);
+	}
+	if (do_bench_yuv) {
+		bench_yuv(width, height);
+		exit(EXIT_SUCCESS);
+	}
+	fft_wisdom_load();
 	dingle_dots.init(width, height, video_bitrate);
+	dingle_dots.thread_pool.init(nthreads);
+	dingle_dots.tracker_type = tracker_type;
+	dingle_dots.fft_size = fft_size;
+	dingle_dots.midi_latency = midi_latency;
+	dingle_dots.synth_enabled = synth_enabled;
+	dingle_dots.motion_cc = motion_cc;
+	dingle_dots.motion_bend = motion_bend;
+	dingle_dots.motion_pressure = motion_pressure;
+	dingle_dots.measure_latency = nprobes;
+	dingle_dots.encoder = encoder;
+	dingle_dots.ninputs = ninputs;
+	dingle_dots.noutputs = noutputs;
+	dingle_dots.set_routes(routes, nroutes);
+	dingle_dots.file_gain = file_gain;
+	dingle_dots.beat_pulse = beat_pulse;
+	dingle_dots.beat_snapshot = beat_snapshot;
+	dingle_dots.midi_clock = midi_clock;
+	if (detector_cascade) {
+		dingle_dots.detector.init(&dingle_dots.detect_frames, detector_cascade);
+	}
+	dingle_dots.flow_speed_cc = flow_speed_cc;
+	dingle_dots.flow_direction_cc = flow_direction_cc;
+	dingle_dots.flow_full_scale_speed = flow_full_scale_speed;
+	dingle_dots.pyramid.min_level_radius = min_level_radius;
 	setup_jack(&dingle_dots);
+	if (nprobes > 0) {
+		measure_latency(&dingle_dots);
+		teardown_jack(&dingle_dots);
+		exit(EXIT_SUCCESS);
+	}
 	setup_signal_handler();
 	g_timeout_add(40, queue_draw_timeout_cb, &dingle_dots);
 	mainloop(&dingle_dots);
+	if (dingle_dots.recording_stopped) {
+		/* Let a recording that was stopped finish its file. */
+		dingle_dots.muxer.free();
+	}
 	dingle_dots.deactivate_sound_shapes();
 	dingle_dots.free();
 	teardown_jack(&dingle_dots);
+	fft_wisdom_save();
 	fprintf(stderr, "\n");
 	return 0;
 }
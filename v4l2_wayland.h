@@ -17,10 +17,11 @@ extern "C" {
 #include <jack/ringbuffer.h>
 #include <cairo.h>
 
+#include "notifier.h"
+
 #define vw_min(a, b) ((a) < (b) ? (a) : (b))
 #define vw_max(a, b) ((a) > (b) ? (a) : (b))
 
-#define FFT_SIZE 256
 #define MIDI_RB_SIZE 1024 * sizeof(struct midi_message)
 
 
@@ -41,30 +42,55 @@ struct hsva {
 	double a;
 };
 
-typedef struct output_frame {
-	uint32_t *data;
-	uint32_t size;
-	struct timespec ts;
-} output_frame;
-
 typedef struct OutputStream {
 	AVStream *st;
 	AVCodecContext *enc;
 	int64_t next_pts;
 	struct timespec first_time;
 	int samples_count;
+	int in_channels;          // interleaved in the audio ring
 	int64_t overruns;
-	output_frame out_frame;
 	AVFrame *frame;
 	AVFrame *tmp_frame;
 	struct SwsContext *sws_ctx;
 	struct SwrContext *swr_ctx;
 } OutputStream;
 
+typedef enum {
+	ENCODER_RC_VBR = 0,        // bit rate is the average
+	ENCODER_RC_CBR,            // and the ceiling, over a one second buffer
+	ENCODER_RC_CRF             // constant quality, bit rate unused
+} encoder_rate_controls;
+
+typedef struct encoder_settings {
+	const char *codec;         // encoder name, NULL for the container default
+	const char *preset;        // NULL for the encoder's own default
+	int threads;               // 0 lets the encoder choose
+	int thread_type;           // FF_THREAD_FRAME and/or FF_THREAD_SLICE
+	int gop_size;
+	int rate_control;
+	double quality;            // crf, or qscale for encoders without one
+	AVDictionary *options;     // key=value pairs given to the encoder last
+} encoder_settings;
+
+class SoundShape;
+class OpticalFlow;
+class LumaPyramid;
+struct flow_vector;
+
+typedef struct motion_job {
+	SoundShape **shapes;
+	int nshapes;
+	int chunk;
+	LumaPyramid *pyramid;
+	double *diffs;
+	OpticalFlow *flow;
+	struct flow_vector *flows;
+} motion_job;
+
 typedef struct disk_thread_info {
 	pthread_t thread_id;
-	pthread_mutex_t lock;
-	pthread_cond_t data_ready;
+	Notifier data_ready;
 	jack_ringbuffer_t *ring_buf;
 	OutputStream stream;
 } disk_thread_info_t;
@@ -1,5 +1,6 @@
 #include "dingle_dots.h"
 #include "video_file_source.h"
+#include "muxing.h"
 #include <boost/bind.hpp>
 #include <jack/ringbuffer.h>
 #include <jack/jack.h>
@@ -61,6 +62,8 @@ int VideoFile::create(char *name, double x, double y, uint64_t z) {
 	this->pos.y = y;
 	this->z = z;
 	this->have_audio = 0;
+	this->gain = this->dingle_dots->file_gain;
+	this->channels = this->dingle_dots->noutputs;
 	this->nb_frames_played = 0;
 	this->playing = 0;
 	this->paused = 0;
@@ -81,7 +84,9 @@ int VideoFile::destroy() {
 	av_packet_unref(&this->pkt);
 	sws_freeContext(this->video_resample);
 	swr_free(&this->audio_resample);
-	pthread_mutex_unlock(&this->video_lock);
+	this->video_data_ready.free();
+	this->audio_data_ready.free();
+	this->unpaused.free();
 	jack_ringbuffer_free(this->abuf);
 	jack_ringbuffer_free(this->vbuf);
 	avcodec_close(this->video_dec_ctx);
@@ -154,27 +159,37 @@ void *VideoFile::thread(void *arg) {
 	vf->video_resample = sws_getContext(vf->pos.width, vf->pos.height, vf->pix_fmt,
 								  vf->pos.width, vf->pos.height, AV_PIX_FMT_BGRA, SWS_BICUBIC, NULL, NULL, NULL);
 	if (vf->have_audio) {
+		/* swr up or down mixes whatever the file has to one interleaved
+		 * channel per JACK output, ready for the ring. */
+		int64_t in_layout = vf->audio_stream->codecpar->channel_layout;
+		if (!in_layout) {
+			in_layout = audio_channel_layout(vf->audio_stream->codecpar->channels);
+		}
 		vf->audio_resample = swr_alloc_set_opts(NULL,
-												AV_CH_LAYOUT_STEREO,
-												AV_SAMPLE_FMT_FLTP,
+												audio_channel_layout(vf->channels),
+												AV_SAMPLE_FMT_FLT,
 												jack_get_sample_rate(vf->dingle_dots->client),
-												vf->audio_stream->codecpar->channel_layout,
+												in_layout,
 												(AVSampleFormat) vf->audio_stream->codecpar->format,
 												vf->audio_stream->codecpar->sample_rate, 0, NULL);
-		swr_init(vf->audio_resample);
+		if (!vf->audio_resample || swr_init(vf->audio_resample) < 0) {
+			printf("cannot convert the audio of %s, playing it silent\n", vf->name);
+			swr_free(&vf->audio_resample);
+			av_frame_free(&vf->audio_frame);
+			vf->have_audio = 0;
+		}
 	}
 	av_init_packet(&vf->pkt);
 	vf->pkt.data = NULL;
 	vf->pkt.size = 0;
-	pthread_mutex_init(&vf->video_lock, NULL);
-	pthread_cond_init(&vf->video_data_ready, NULL);
-	pthread_mutex_init(&vf->audio_lock, NULL);
-	pthread_cond_init(&vf->audio_data_ready, NULL);
+	vf->video_data_ready.init();
+	vf->audio_data_ready.init();
+	vf->unpaused.init();
 	vf->vbuf = jack_ringbuffer_create(5*vf->video_dst_bufsize);
 	memset(vf->vbuf->buf, 0, vf->vbuf->size);
 	vf->abuf = jack_ringbuffer_create(
 				jack_get_sample_rate(
-					vf->dingle_dots->client) *
+					vf->dingle_dots->client) * vf->channels / 2 *
 				sizeof(jack_default_audio_sample_t));
 	memset(vf->abuf->buf, 0, vf->abuf->size);
 	vf->decoded_video_frame = av_frame_alloc();
@@ -186,14 +201,13 @@ void *VideoFile::thread(void *arg) {
 				   (AVPixelFormat)vf->decoded_video_frame->format, 1);
 	vf->allocated = 1;
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_mutex_lock(&vf->video_lock);
 	double pts;
 	uint8_t **output = NULL;
 	int out_samples, max_out_samples;
 	if (vf->have_audio) {
 		out_samples = max_out_samples = 1024;
-		av_samples_alloc_array_and_samples(&output, NULL, 2, out_samples,
-										   AV_SAMPLE_FMT_FLTP, 1);
+		av_samples_alloc_array_and_samples(&output, NULL, vf->channels, out_samples,
+										   AV_SAMPLE_FMT_FLT, 1);
 	}
 	while(av_seek_frame(vf->fmt_ctx, vf->video_stream_idx, 0, AVFMT_SEEK_TO_PTS) >= 0) {
 		vf->play();
@@ -204,7 +218,7 @@ void *VideoFile::thread(void *arg) {
 		vf->nb_frames_played = 0;
 		while(av_read_frame(vf->fmt_ctx, &vf->pkt) >= 0) {
 			if (vf->paused) {
-				pthread_cond_wait(&vf->pause_unpuase, &vf->pause_lock);
+				while (vf->paused) vf->unpaused.wait();
 				jack_ringbuffer_reset(vf->vbuf);
 				jack_ringbuffer_reset(vf->abuf);
 			}
@@ -221,11 +235,6 @@ void *VideoFile::thread(void *arg) {
 						fprintf(stderr, "Error during decoding\n");
 						goto end;
 					}
-					if (av_get_channel_layout_nb_channels(
-								vf->audio_frame->channel_layout) != 2) {
-						fprintf(stderr, "Unsupported frame parameters\n");
-						goto end;
-					}
 					out_samples = av_rescale_rnd(swr_get_delay(vf->audio_resample,
 															   vf->audio_frame->sample_rate) +
 												 vf->audio_frame->nb_samples,
@@ -234,8 +243,8 @@ void *VideoFile::thread(void *arg) {
 												 AV_ROUND_UP);
 					if (out_samples > max_out_samples) {
 						av_freep(&output[0]);
-						if (av_samples_alloc(output, NULL, 2, out_samples,
-											 AV_SAMPLE_FMT_FLTP, 1) < 0) {
+						if (av_samples_alloc(output, NULL, vf->channels, out_samples,
+											 AV_SAMPLE_FMT_FLT, 1) < 0) {
 							goto end;
 						}
 						max_out_samples = out_samples;
@@ -244,20 +253,13 @@ void *VideoFile::thread(void *arg) {
 											  (const uint8_t **)vf->audio_frame->extended_data,
 											  vf->audio_frame->nb_samples);
 					int space =	sizeof(jack_default_audio_sample_t) *
-							out_samples * 2;
+							out_samples * vf->channels;
 					int buf_space = jack_ringbuffer_write_space(vf->abuf);
 					while (buf_space < space) {
-						pthread_cond_wait(&vf->audio_data_ready, &vf->audio_lock);
+						vf->audio_data_ready.wait();
 						buf_space = jack_ringbuffer_write_space(vf->abuf);
 					}
-					jack_default_audio_sample_t sample;
-					for (int i = 0; i < out_samples; ++i) {
-						for (int j = 0; j < 2; ++j) {
-							sample = ((float*)output[j])[i];
-							jack_ringbuffer_write(vf->abuf, (const char *)&sample,
-												  sizeof(jack_default_audio_sample_t));
-						}
-					}
+					jack_ringbuffer_write(vf->abuf, (const char *)output[0], space);
 				}
 			} else if (vf->pkt.stream_index == vf->video_stream_idx) {
 				ret = avcodec_send_packet(vf->video_dec_ctx,&vf->pkt);
@@ -279,7 +281,7 @@ void *VideoFile::thread(void *arg) {
 						int buf_space = jack_ringbuffer_write_space(vf->vbuf);
 						while (buf_space < space) {
 							gtk_widget_queue_draw(vf->dingle_dots->drawing_area);
-							pthread_cond_wait(&vf->video_data_ready, &vf->video_lock);
+							vf->video_data_ready.wait();
 							buf_space = jack_ringbuffer_write_space(vf->vbuf);
 						}
 						jack_ringbuffer_write(vf->vbuf, (const char *)&pts, sizeof(double));
@@ -297,7 +299,7 @@ void *VideoFile::thread(void *arg) {
 		vf->video_decoding_finished = 1;
 		while (vf->playing) {
 			gtk_widget_queue_draw(vf->dingle_dots->drawing_area);
-			pthread_cond_wait(&vf->video_data_ready, &vf->video_lock);
+			vf->video_data_ready.wait();
 		}
 	}
 end:
@@ -324,10 +326,7 @@ void VideoFile::toggle_play_pause()
 		this->paused = 1;
 	else {
 		this->paused = 0;
-		if (pthread_mutex_trylock(&this->pause_lock) == 0) {
-			pthread_cond_signal(&this->pause_unpuase);
-			pthread_mutex_unlock(&this->pause_lock);
-		}
+		this->unpaused.notify();
 	}
 }
 
@@ -346,25 +345,16 @@ bool VideoFile::render(std::vector<cairo_t *> &contexts) {
 				if (!this->paused) {
 					if (this->video_decoding_finished && jack_ringbuffer_read_space(this->vbuf) == 0) {
 						this->playing = 0;
-						if (pthread_mutex_trylock(&this->video_lock) == 0) {
-							pthread_cond_signal(&this->video_data_ready);
-							pthread_mutex_unlock(&this->video_lock);
-						}
+						this->video_data_ready.notify();
 					} else {
 						while (jack_ringbuffer_read_space(this->vbuf) >= (this->video_dst_bufsize + sizeof(double))) {
 							jack_ringbuffer_peek(this->vbuf, (char *)&pts, sizeof(double));
 							if (diff_sec >= pts) {
 								jack_ringbuffer_read_advance(this->vbuf, sizeof(double));
 								jack_ringbuffer_read(this->vbuf, (char *)this->decoded_video_frame->data[0], this->video_dst_bufsize);
-								if (pthread_mutex_trylock(&this->video_lock) == 0) {
-									pthread_cond_signal(&this->video_data_ready);
-									pthread_mutex_unlock(&this->video_lock);
-								}
+								this->video_data_ready.notify();
 							} else {
-								if (pthread_mutex_trylock(&this->video_lock) == 0) {
-									pthread_cond_signal(&this->video_data_ready);
-									pthread_mutex_unlock(&this->video_lock);
-								}
+								this->video_data_ready.notify();
 								break;
 							}
 						}
@@ -20,6 +20,7 @@ extern "C" {
 
 #include "v4l2_wayland.h"
 #include "drawable.h"
+#include "notifier.h"
 
 class VideoFile : public Drawable {
 public:
@@ -51,12 +52,9 @@ public:
 	AVFrame *audio_frame;
 	AVPacket pkt;
 	pthread_t thread_id;
-	pthread_mutex_t video_lock;
-	pthread_cond_t video_data_ready;
-	pthread_mutex_t audio_lock;
-	pthread_cond_t audio_data_ready;
-	pthread_mutex_t pause_lock;
-	pthread_cond_t pause_unpuase;
+	Notifier video_data_ready;
+	Notifier audio_data_ready;
+	Notifier unpaused;
 	int playing;
 	int paused;
 	int audio_playing;
@@ -65,6 +63,8 @@ public:
 	int audio_decoding_started;
 	int audio_decoding_finished;
 	uint8_t have_audio;
+	float gain;
+	int channels;                // interleaved in abuf, one per JACK output
 	uint64_t nb_frames_played;
 	double total_playtime;
 	double current_playtime;
@@ -0,0 +1,132 @@
+#include "yuv.h"
+#include "luma_sse.h"
+
+#define YUV_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* BT.601 limited range in 8 bit fixed point: luma from one pixel, chroma
+ * from the sum of four, hence the extra two bits of shift. */
+static inline uint8_t luma(const uint8_t *p) {
+	return (25 * p[0] + 129 * p[1] + 66 * p[2] + 128 + (16 << 8)) >> 8;
+}
+
+static inline uint8_t chroma_u(int b, int g, int r) {
+	return (112 * b - 74 * g - 38 * r + 512 + (128 << 10)) >> 10;
+}
+
+static inline uint8_t chroma_v(int b, int g, int r) {
+	return (-18 * b - 94 * g + 112 * r + 512 + (128 << 10)) >> 10;
+}
+
+#if defined(__SSE2__)
+/* The BGRA sums of the two 2x2 blocks under four pixels of each row. */
+static inline __m128i block_sums2(const uint8_t *r0, const uint8_t *r1) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_loadu_si128((const __m128i *)r0);
+	__m128i b = _mm_loadu_si128((const __m128i *)r1);
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+}
+
+/* Two blocks to two 32 bit chroma sums, in the low lanes. */
+static inline __m128i chroma2(__m128i sums, __m128i w) {
+	__m128i c = _mm_madd_epi16(sums, w);
+	c = _mm_add_epi32(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_shuffle_epi32(c, _MM_SHUFFLE(3, 3, 2, 0));
+}
+
+static inline __m128i chroma8(const __m128i s[4], __m128i w) {
+	const __m128i bias = _mm_set1_epi32(512 + (128 << 10));
+	__m128i c0 = _mm_unpacklo_epi64(chroma2(s[0], w), chroma2(s[1], w));
+	__m128i c1 = _mm_unpacklo_epi64(chroma2(s[2], w), chroma2(s[3], w));
+	c0 = _mm_srai_epi32(_mm_add_epi32(c0, bias), 10);
+	c1 = _mm_srai_epi32(_mm_add_epi32(c1, bias), 10);
+	__m128i c = _mm_packs_epi32(c0, c1);
+	return _mm_packus_epi16(c, c);
+}
+#endif
+
+void bgra_to_i420_rows(const uint8_t *src, int src_stride, uint8_t *const dst[3],
+					   const int dst_stride[3], int width, int height,
+					   int row_start, int row_end) {
+	int cwidth = (width + 1) / 2;
+	for (int j = row_start; j < row_end; j += 2) {
+		const uint8_t *r0 = src + j * src_stride;
+		const uint8_t *r1 = j + 1 < height ? r0 + src_stride : r0;
+		uint8_t *y0 = dst[0] + j * dst_stride[0];
+		uint8_t *y1 = j + 1 < height ? y0 + dst_stride[0] : y0;
+		uint8_t *u = dst[1] + j / 2 * dst_stride[1];
+		uint8_t *v = dst[2] + j / 2 * dst_stride[2];
+		int i = 0, k = 0;
+#if defined(__SSE2__)
+		const __m128i wy = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+		const __m128i by = _mm_set1_epi32(128 + (16 << 8));
+		luma_row_sse2(r0, y0, width, wy, by);
+		i = luma_row_sse2(r1, y1, width, wy, by);
+		const __m128i wu = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+		const __m128i wv = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+		for (; 2 * k + 16 <= width; k += 8) {
+			__m128i s[4];
+			for (int q = 0; q < 4; q++) {
+				s[q] = block_sums2(r0 + 8 * k + 16 * q, r1 + 8 * k + 16 * q);
+			}
+			_mm_storel_epi64((__m128i *)(u + k), chroma8(s, wu));
+			_mm_storel_epi64((__m128i *)(v + k), chroma8(s, wv));
+		}
+#endif
+		for (; i < width; i++) {
+			y0[i] = luma(r0 + 4 * i);
+			y1[i] = luma(r1 + 4 * i);
+		}
+		for (; k < cwidth; k++) {
+			const uint8_t *a = r0 + 8 * k;
+			const uint8_t *b = r1 + 8 * k;
+			int n = 2 * k + 1 < width ? 4 : 0;
+			int sb = a[0] + b[0] + a[n] + b[n];
+			int sg = a[1] + b[1] + a[n + 1] + b[n + 1];
+			int sr = a[2] + b[2] + a[n + 2] + b[n + 2];
+			u[k] = chroma_u(sb, sg, sr);
+			v[k] = chroma_v(sb, sg, sr);
+		}
+	}
+}
+
+struct yuv_job {
+	const uint8_t *src;
+	int src_stride;
+	uint8_t *const *dst;
+	const int *dst_stride;
+	int width;
+	int height;
+	int band;                  // rows per task, even
+};
+
+static void yuv_band(int task, void *arg) {
+	yuv_job *job = (yuv_job *)arg;
+	int start = task * job->band;
+	bgra_to_i420_rows(job->src, job->src_stride, job->dst, job->dst_stride,
+					  job->width, job->height, start,
+					  YUV_MIN(start + job->band, job->height));
+}
+
+/* A few bands per worker, so a thread held up elsewhere does not hold
+ * up the frame. */
+void bgra_to_i420(ThreadPool *pool, const uint8_t *src, int src_stride,
+				  uint8_t *const dst[3], const int dst_stride[3], int width, int height) {
+	int pairs = (height + 1) / 2;
+	int nbands = pool ? YUV_MIN(pairs, 4 * pool->get_nthreads()) : 1;
+	if (nbands <= 1) {
+		bgra_to_i420_rows(src, src_stride, dst, dst_stride, width, height, 0, height);
+		return;
+	}
+	yuv_job job;
+	job.src = src;
+	job.src_stride = src_stride;
+	job.dst = dst;
+	job.dst_stride = dst_stride;
+	job.width = width;
+	job.height = height;
+	job.band = 2 * ((pairs + nbands - 1) / nbands);
+	nbands = (height + job.band - 1) / job.band;
+	pool->parallel_for(nbands, yuv_band, &job);
+}
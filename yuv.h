@@ -0,0 +1,20 @@
+#if !defined (_YUV_H)
+#define _YUV_H (1)
+
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+/* BGRA (cairo ARGB32 in memory) to 8 bit planar 4:2:0 with the BT.601
+ * limited range matrix, the same one swscale uses by default. Chroma is
+ * the mean of each 2x2 block. Rows are converted in pairs, so bands of
+ * pairs are independent and bgra_to_i420() splits them across the pool.
+ * Odd sizes repeat the last column or row into the final chroma
+ * sample. */
+void bgra_to_i420_rows(const uint8_t *src, int src_stride, uint8_t *const dst[3],
+					   const int dst_stride[3], int width, int height,
+					   int row_start, int row_end);
+void bgra_to_i420(ThreadPool *pool, const uint8_t *src, int src_stride,
+				  uint8_t *const dst[3], const int dst_stride[3], int width, int height);
+
+#endif